@@ -0,0 +1,443 @@
+/*
+ * FTP load generator
+ *
+ * Replays a recorded command script from N concurrent simulated clients
+ * against an FTP server (a device, or the host build in extras/host) and
+ * reports per command latency percentiles, data throughput and failure
+ * codes.
+ *
+ *   usage: ftpload [-h host] [-p port] [-c clients] [-i iterations]
+ *                  [-r ramp_ms] [-t timeout_ms] script
+ *
+ * Script format, one command per line as the client would send it:
+ *
+ *   # comment
+ *   USER esp
+ *   PASS esp
+ *   PASV
+ *   LIST
+ *   RETR /config.json
+ *   STOR /up_$ID.bin 65536     <- the size is the number of bytes uploaded
+ *   SLEEP 250                  <- pause, not sent to the server
+ *   QUIT
+ *
+ * $ID is replaced by the index of the simulated client. LIST, NLST, MLSD,
+ * RETR and STOR open a data connection on the address of the last PASV
+ * reply. With -r 0 (the default) every client connects at once, which is
+ * what a reconnect storm after a WiFi outage looks like.
+ */
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options
+{
+  std::string host = "127.0.0.1";
+  int port = 21;
+  int clients = 1;
+  int iterations = 1;
+  int rampMs = 0;
+  int timeoutMs = 10000;
+  std::string script;
+};
+
+struct Stats
+{
+  std::map<std::string, std::vector<double>> latency; // ms, per verb
+  std::map<std::string, uint32_t> failures;           // "VERB code" -> count
+  uint64_t bytesDown = 0, bytesUp = 0;
+  double dataSeconds = 0;
+  uint32_t sessions = 0, sessionsFailed = 0;
+
+  void merge(const Stats &o)
+  {
+    for (auto &l : o.latency)
+      latency[l.first].insert(latency[l.first].end(), l.second.begin(), l.second.end());
+    for (auto &f : o.failures)
+      failures[f.first] += f.second;
+    bytesDown += o.bytesDown;
+    bytesUp += o.bytesUp;
+    dataSeconds += o.dataSeconds;
+    sessions += o.sessions;
+    sessionsFailed += o.sessionsFailed;
+  }
+};
+
+static double msSince(Clock::time_point t)
+{
+  return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+}
+
+static int tcpConnect(const std::string &host, int port, int timeoutMs)
+{
+  addrinfo hints = {}, *res = nullptr;
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0)
+    return -1;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd >= 0)
+  {
+    timeval tv = {timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (connect(fd, res->ai_addr, res->ai_addrlen) < 0)
+    {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(res);
+  return fd;
+}
+
+class Session
+{
+public:
+  Session(const Options &opt, int id, Stats &st) : opt_(opt), id_(id), st_(st) {}
+  ~Session()
+  {
+    if (ctrl_ >= 0)
+      close(ctrl_);
+  }
+
+  bool run(const std::vector<std::string> &script)
+  {
+    Clock::time_point t0 = Clock::now();
+    ctrl_ = tcpConnect(opt_.host, opt_.port, opt_.timeoutMs);
+    if (ctrl_ < 0)
+    {
+      st_.failures["CONNECT refused"]++;
+      return false;
+    }
+    int code = readReply();
+    st_.latency["CONNECT"].push_back(msSince(t0));
+    if (code != 220)
+    {
+      fail("CONNECT", code);
+      return false;
+    }
+    for (const std::string &raw : script)
+    {
+      std::string line = expand(raw);
+      std::string verb = line.substr(0, line.find(' '));
+      if (verb == "SLEEP")
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(atoi(line.c_str() + 6)));
+        continue;
+      }
+      if (!command(verb, line))
+        return false;
+      if (verb == "QUIT")
+        break;
+    }
+    return true;
+  }
+
+private:
+  std::string expand(const std::string &s)
+  {
+    std::string r = s;
+    size_t p;
+    while ((p = r.find("$ID")) != std::string::npos)
+      r.replace(p, 3, std::to_string(id_));
+    return r;
+  }
+
+  void fail(const std::string &verb, int code)
+  {
+    st_.failures[verb + " " + (code > 0 ? std::to_string(code) : std::string("timeout"))]++;
+  }
+
+  // Read a complete (possibly multi-line) reply, return its code or -1
+  int readReply(std::string *text = nullptr)
+  {
+    int code = -1;
+    for (;;)
+    {
+      std::string line;
+      if (!readLine(line))
+        return -1;
+      if (line.size() < 3 || !isdigit(line[0]))
+        continue;
+      if (code < 0)
+        code = atoi(line.c_str());
+      if (text)
+        *text += line + "\n";
+      if (atoi(line.c_str()) == code && (line.size() == 3 || line[3] == ' '))
+        return code;
+    }
+  }
+
+  bool readLine(std::string &line)
+  {
+    for (;;)
+    {
+      size_t nl = in_.find('\n');
+      if (nl != std::string::npos)
+      {
+        line = in_.substr(0, nl);
+        if (!line.empty() && line.back() == '\r')
+          line.pop_back();
+        in_.erase(0, nl + 1);
+        return true;
+      }
+      char tmp[512];
+      ssize_t n = recv(ctrl_, tmp, sizeof(tmp), 0);
+      if (n <= 0)
+        return false;
+      in_.append(tmp, n);
+    }
+  }
+
+  bool send(const std::string &line)
+  {
+    std::string l = line + "\r\n";
+    return ::send(ctrl_, l.data(), l.size(), MSG_NOSIGNAL) == (ssize_t)l.size();
+  }
+
+  bool command(const std::string &verb, std::string line)
+  {
+    bool isData = verb == "LIST" || verb == "NLST" || verb == "MLSD" ||
+                  verb == "RETR" || verb == "STOR";
+    uint64_t upload = 0;
+    if (verb == "STOR")
+    {
+      // "STOR path size": the size is ours, not the server's
+      size_t sp = line.rfind(' ');
+      if (sp != std::string::npos && sp > 5)
+      {
+        upload = strtoull(line.c_str() + sp + 1, nullptr, 10);
+        line.erase(sp);
+      }
+    }
+
+    Clock::time_point t0 = Clock::now();
+    int dfd = -1;
+    if (isData)
+    {
+      dfd = tcpConnect(pasvHost_, pasvPort_, opt_.timeoutMs);
+      if (dfd < 0)
+      {
+        st_.failures[verb + " data-connect"]++;
+        return false;
+      }
+    }
+    if (!send(line))
+    {
+      fail(verb, -1);
+      return false;
+    }
+    std::string text;
+    int code = readReply(&text);
+    if (isData && code > 0 && code < 300)
+    {
+      Clock::time_point d0 = Clock::now();
+      if (verb == "STOR")
+        st_.bytesUp += pushData(dfd, upload);
+      else
+        st_.bytesDown += pullData(dfd);
+      close(dfd);
+      dfd = -1;
+      st_.dataSeconds += msSince(d0) / 1000.0;
+      if (code < 200)
+        code = readReply();
+    }
+    if (dfd >= 0)
+      close(dfd);
+    if (code < 0 || code >= 400)
+    {
+      fail(verb, code);
+      return code > 0;
+    }
+    st_.latency[verb].push_back(msSince(t0));
+    if (verb == "PASV")
+      parsePasv(text);
+    return true;
+  }
+
+  uint64_t pullData(int fd)
+  {
+    uint64_t total = 0;
+    char tmp[8192];
+    ssize_t n;
+    while ((n = recv(fd, tmp, sizeof(tmp), 0)) > 0)
+      total += n;
+    return total;
+  }
+
+  uint64_t pushData(int fd, uint64_t size)
+  {
+    std::vector<char> tmp(8192, 'a' + id_ % 26);
+    uint64_t total = 0;
+    while (total < size)
+    {
+      size_t chunk = std::min<uint64_t>(tmp.size(), size - total);
+      ssize_t n = ::send(fd, tmp.data(), chunk, MSG_NOSIGNAL);
+      if (n <= 0)
+        break;
+      total += n;
+    }
+    shutdown(fd, SHUT_WR);
+    // Wait for the server to close its side so the 226 reflects the upload
+    pullData(fd);
+    return total;
+  }
+
+  void parsePasv(const std::string &text)
+  {
+    size_t p = text.find('(');
+    unsigned h[4], ph, pl;
+    if (p != std::string::npos &&
+        sscanf(text.c_str() + p + 1, "%u,%u,%u,%u,%u,%u", &h[0], &h[1], &h[2], &h[3], &ph, &pl) == 6)
+    {
+      char ip[16];
+      snprintf(ip, sizeof(ip), "%u.%u.%u.%u", h[0], h[1], h[2], h[3]);
+      // A server behind NAT, or the host build, may advertise 0.0.0.0
+      pasvHost_ = strcmp(ip, "0.0.0.0") ? ip : opt_.host;
+      pasvPort_ = ph * 256 + pl;
+    }
+  }
+
+  const Options &opt_;
+  int id_;
+  Stats &st_;
+  int ctrl_ = -1;
+  std::string in_;
+  std::string pasvHost_;
+  int pasvPort_ = 0;
+};
+
+static double percentile(std::vector<double> &v, double p)
+{
+  if (v.empty())
+    return 0;
+  size_t i = std::min(v.size() - 1, (size_t)(p / 100.0 * v.size()));
+  return v[i];
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-h host] [-p port] [-c clients] [-i iterations] "
+                  "[-r ramp_ms] [-t timeout_ms] script\n",
+          prog);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  Options opt;
+  int c;
+  while ((c = getopt(argc, argv, "h:p:c:i:r:t:")) != -1)
+  {
+    switch (c)
+    {
+    case 'h':
+      opt.host = optarg;
+      break;
+    case 'p':
+      opt.port = atoi(optarg);
+      break;
+    case 'c':
+      opt.clients = std::max(1, atoi(optarg));
+      break;
+    case 'i':
+      opt.iterations = std::max(1, atoi(optarg));
+      break;
+    case 'r':
+      opt.rampMs = atoi(optarg);
+      break;
+    case 't':
+      opt.timeoutMs = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind >= argc)
+    usage(argv[0]);
+  opt.script = argv[optind];
+
+  std::vector<std::string> script;
+  std::ifstream in(opt.script);
+  if (!in)
+  {
+    fprintf(stderr, "can't read %s\n", opt.script.c_str());
+    return 1;
+  }
+  for (std::string line; std::getline(in, line);)
+  {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if (!line.empty() && line[0] != '#')
+      script.push_back(line);
+  }
+
+  Stats total;
+  std::mutex lock;
+  std::vector<std::thread> threads;
+  Clock::time_point t0 = Clock::now();
+  for (int i = 0; i < opt.clients; i++)
+  {
+    threads.emplace_back([&, i]()
+                         {
+      Stats st;
+      for (int it = 0; it < opt.iterations; it++)
+      {
+        Session s(opt, i, st);
+        st.sessions++;
+        if (!s.run(script))
+          st.sessionsFailed++;
+      }
+      std::lock_guard<std::mutex> g(lock);
+      total.merge(st); });
+    if (opt.rampMs > 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(opt.rampMs));
+  }
+  for (auto &t : threads)
+    t.join();
+  double elapsed = msSince(t0) / 1000.0;
+
+  printf("%d clients x %d iterations against %s:%d in %.2f s\n",
+         opt.clients, opt.iterations, opt.host.c_str(), opt.port, elapsed);
+  printf("sessions: %u, failed: %u\n\n", total.sessions, total.sessionsFailed);
+  printf("%-8s %8s %10s %10s %10s %10s\n", "command", "count", "p50 ms", "p90 ms", "p99 ms", "max ms");
+  for (auto &l : total.latency)
+  {
+    std::vector<double> &v = l.second;
+    std::sort(v.begin(), v.end());
+    printf("%-8s %8zu %10.2f %10.2f %10.2f %10.2f\n", l.first.c_str(), v.size(),
+           percentile(v, 50), percentile(v, 90), percentile(v, 99), v.empty() ? 0 : v.back());
+  }
+  printf("\nthroughput: %.1f kB/s down, %.1f kB/s up (%llu / %llu bytes)\n",
+         total.bytesDown / 1024.0 / elapsed, total.bytesUp / 1024.0 / elapsed,
+         (unsigned long long)total.bytesDown, (unsigned long long)total.bytesUp);
+  if (total.dataSeconds > 0)
+    printf("per data connection: %.1f kB/s\n",
+           (total.bytesDown + total.bytesUp) / 1024.0 / total.dataSeconds);
+  if (!total.failures.empty())
+  {
+    printf("\nfailures:\n");
+    for (auto &f : total.failures)
+      printf("  %-24s %u\n", f.first.c_str(), f.second);
+  }
+  return total.sessionsFailed ? 2 : 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * Host (Linux) stand-in for the Arduino core
+ *
+ * Just enough of the ESP8266/ESP32 Arduino API to compile and run
+ * FtpServer on a workstation: timing, Print, IPAddress and String.
+ * The host build defines ESP32 so the ESP32 branches of the library
+ * are used; see extras/README.md.
+ */
+
+#ifndef FTP_HOST_ARDUINO_H
+#define FTP_HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "WString.h"
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define PSTR(s) (s)
+#define printf_P printf
+#define F(s) (s)
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+// Free heap as reported by the host allocator (mallinfo2)
+uint32_t hostFreeHeap();
+
+// The few ESP.* calls of the library
+class EspClass
+{
+public:
+  uint32_t getFreeHeap() { return hostFreeHeap(); }
+  uint32_t getMaxAllocHeap() { return 0x10000; } // as much as an ESP32 without PSRAM
+  uint32_t getMaxFreeBlockSize() { return getMaxAllocHeap(); } // ESP8266 name
+  uint32_t getFreeSketchSpace() { return 0x100000; }
+};
+
+extern EspClass ESP;
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) { return write(&c, 1); }
+  virtual size_t write(const uint8_t *buffer, size_t size) = 0;
+  size_t write(const char *str) { return write((const uint8_t *)str, strlen(str)); }
+  virtual int availableForWrite() { return 0; }
+
+  size_t print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t print(const String &s) { return write((const uint8_t *)s.c_str(), s.length()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int v) { return print(String(v)); }
+  size_t print(unsigned int v) { return print(String(v)); }
+  size_t print(long v) { return print(String(v)); }
+  size_t print(unsigned long v) { return print(String(v)); }
+  size_t println() { return print("\r\n"); }
+  template <typename T>
+  size_t println(const T &v)
+  {
+    String line = String() + v;
+    line += "\r\n";
+    return print(line);
+  }
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() { return -1; }
+  virtual void flush() {}
+};
+
+class IPAddress
+{
+public:
+  IPAddress() : addr_{0, 0, 0, 0} {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : addr_{a, b, c, d} {}
+  explicit IPAddress(uint32_t v) { memcpy(addr_, &v, 4); }
+  uint8_t operator[](int i) const { return addr_[i]; }
+  uint8_t &operator[](int i) { return addr_[i]; }
+  operator uint32_t() const
+  {
+    uint32_t v;
+    memcpy(&v, addr_, 4);
+    return v;
+  }
+  bool operator==(const IPAddress &o) const { return memcmp(addr_, o.addr_, 4) == 0; }
+  bool operator!=(const IPAddress &o) const { return !(*this == o); }
+  String toString() const
+  {
+    char tmp[16];
+    snprintf(tmp, sizeof(tmp), "%u.%u.%u.%u", addr_[0], addr_[1], addr_[2], addr_[3]);
+    return String(tmp);
+  }
+
+private:
+  uint8_t addr_[4];
+};
+
+#endif // FTP_HOST_ARDUINO_H
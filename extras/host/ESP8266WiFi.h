@@ -0,0 +1,11 @@
+/*
+ * Host (Linux) stand-in for the ESP8266WiFi.h header
+ */
+
+#ifndef FTP_HOST_ESP8266WIFI_H
+#define FTP_HOST_ESP8266WIFI_H
+
+#include "WiFiClient.h"
+#include "WiFiServer.h"
+
+#endif // FTP_HOST_ESP8266WIFI_H
@@ -0,0 +1,153 @@
+/*
+ * OpenSSL provider of FtpTls for the host build
+ */
+
+#include "FtpTlsOpenSSL.h"
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <poll.h>
+
+class FtpTlsOpenSSLSession : public FtpTlsSession
+{
+public:
+  FtpTlsOpenSSLSession(SSL *ssl, int fd) : ssl_(ssl), fd_(fd) {}
+  ~FtpTlsOpenSSLSession() { SSL_free(ssl_); }
+
+  int8_t handshake() override
+  {
+    int rc = SSL_accept(ssl_);
+    if (rc == 1)
+      return 1;
+    int err = SSL_get_error(ssl_, rc);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+      return 0;
+    ERR_print_errors_fp(stderr);
+    return -1;
+  }
+
+  boolean resumed() override { return SSL_session_reused(ssl_); }
+
+  boolean closed() override { return (SSL_get_shutdown(ssl_) & SSL_RECEIVED_SHUTDOWN) != 0; }
+
+  int available() override
+  {
+    // a record may be waiting in the socket: decrypt it first
+    uint8_t c;
+    if (SSL_pending(ssl_) == 0 && SSL_peek(ssl_, &c, 1) <= 0)
+      return 0;
+    return SSL_pending(ssl_);
+  }
+
+  int read(uint8_t *buf, size_t size) override
+  {
+    int n = SSL_read(ssl_, buf, size);
+    return n > 0 ? n : 0;
+  }
+
+  size_t write(const uint8_t *buf, size_t size) override
+  {
+    // blocks like WiFiClient::write() until everything is queued
+    size_t sent = 0;
+    while (sent < size)
+    {
+      int n = SSL_write(ssl_, buf + sent, size - sent);
+      if (n > 0)
+      {
+        sent += n;
+        continue;
+      }
+      int err = SSL_get_error(ssl_, n);
+      pollfd pfd = {fd_, (short)(err == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT), 0};
+      if ((err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) || poll(&pfd, 1, 5000) <= 0)
+        break;
+    }
+    return sent;
+  }
+
+  void close() override { SSL_shutdown(ssl_); }
+
+private:
+  SSL *ssl_;
+  int fd_;
+};
+
+FtpTlsOpenSSL::~FtpTlsOpenSSL()
+{
+  SSL_CTX_free(ctx_);
+}
+
+bool FtpTlsOpenSSL::begin(const char *certFile, const char *keyFile)
+{
+  ctx_ = SSL_CTX_new(TLS_server_method());
+  if (ctx_ == NULL ||
+      SSL_CTX_use_certificate_chain_file(ctx_, certFile) != 1 ||
+      SSL_CTX_use_PrivateKey_file(ctx_, keyFile, SSL_FILETYPE_PEM) != 1)
+  {
+    ERR_print_errors_fp(stderr);
+    return false;
+  }
+  static const unsigned char sidContext[] = "FtpServer";
+  SSL_CTX_set_session_id_context(ctx_, sidContext, sizeof(sidContext) - 1);
+  SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+  SSL_CTX_set_app_data(ctx_, this);
+  SSL_CTX_sess_set_new_cb(ctx_, newSession);
+  SSL_CTX_sess_set_get_cb(ctx_, getSession);
+  SSL_CTX_sess_set_remove_cb(ctx_, removeSession);
+  SSL_CTX_set_options(ctx_, SSL_OP_NO_TICKET);
+  return true;
+}
+
+int FtpTlsOpenSSL::newSession(SSL *ssl, SSL_SESSION *session)
+{
+  FtpTlsOpenSSL *tls = (FtpTlsOpenSSL *)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+  unsigned int idLen;
+  const unsigned char *id = SSL_SESSION_get_id(session, &idLen);
+  uint8_t buf[FTP_TLS_SESSION_SIZE];
+  unsigned char *p = buf;
+  int len = i2d_SSL_SESSION(session, NULL);
+  if (len > 0 && len <= (int)sizeof(buf) && i2d_SSL_SESSION(session, &p) == len)
+    tls->sessions.save(id, idLen, buf, len);
+  else
+    fprintf(stderr, "TLS session of %d bytes not kept, FTP_TLS_SESSION_SIZE is %d\n", len, FTP_TLS_SESSION_SIZE);
+  return 0; // the cache has a copy, session is not kept
+}
+
+SSL_SESSION *FtpTlsOpenSSL::getSession(SSL *ssl, const unsigned char *id, int idLen, int *copy)
+{
+  FtpTlsOpenSSL *tls = (FtpTlsOpenSSL *)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+  uint8_t buf[FTP_TLS_SESSION_SIZE];
+  *copy = 0;
+  uint16_t len = tls->sessions.load(id, idLen, buf, sizeof(buf));
+  const unsigned char *p = buf;
+  return len > 0 ? d2i_SSL_SESSION(NULL, &p, len) : NULL;
+}
+
+void FtpTlsOpenSSL::removeSession(SSL_CTX *ctx, SSL_SESSION *session)
+{
+  FtpTlsOpenSSL *tls = (FtpTlsOpenSSL *)SSL_CTX_get_app_data(ctx);
+  unsigned int idLen;
+  const unsigned char *id = SSL_SESSION_get_id(session, &idLen);
+  tls->sessions.remove(id, idLen);
+}
+
+FtpTlsSession *FtpTlsOpenSSL::accept(WiFiClient &sock)
+{
+  if (ctx_ == NULL || sock.fd() < 0)
+    return NULL;
+  SSL *ssl = SSL_new(ctx_);
+  if (ssl == NULL)
+    return NULL;
+  SSL_set_fd(ssl, sock.fd());
+  return new FtpTlsOpenSSLSession(ssl, sock.fd());
+}
+
+long FtpTlsOpenSSL::sessionHits()
+{
+  return sessions.hits;
+}
+
+long FtpTlsOpenSSL::sessionMisses()
+{
+  return sessions.misses;
+}
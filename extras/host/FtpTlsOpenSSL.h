@@ -0,0 +1,40 @@
+/*
+ * OpenSSL provider of FtpTls for the host build
+ *
+ * Server sessions are kept, serialized, in the FtpTlsSessionCache of the
+ * library, as a device provider does, through the external cache
+ * callbacks of the SSL_CTX. Tickets are disabled so that resumption goes
+ * through this cache with TLS 1.2 and 1.3 alike.
+ */
+
+#ifndef FTP_HOST_TLS_OPENSSL_H
+#define FTP_HOST_TLS_OPENSSL_H
+
+#include "FtpServer.h"
+
+typedef struct ssl_ctx_st SSL_CTX;
+typedef struct ssl_st SSL;
+typedef struct ssl_session_st SSL_SESSION;
+
+class FtpTlsOpenSSL : public FtpTls
+{
+public:
+  ~FtpTlsOpenSSL();
+
+  // PEM files of the certificate chain and of its private key
+  bool begin(const char *certFile, const char *keyFile);
+  FtpTlsSession *accept(WiFiClient &sock) override;
+
+  // statistics of the session cache
+  long sessionHits();
+  long sessionMisses();
+
+private:
+  static int newSession(SSL *ssl, SSL_SESSION *session);
+  static SSL_SESSION *getSession(SSL *ssl, const unsigned char *id, int idLen, int *copy);
+  static void removeSession(SSL_CTX *ctx, SSL_SESSION *session);
+
+  SSL_CTX *ctx_ = NULL;
+};
+
+#endif // FTP_HOST_TLS_OPENSSL_H
@@ -0,0 +1,261 @@
+/*
+ * Host (Linux) implementation of WiFiClient / WiFiServer over BSD sockets
+ */
+
+#include <Arduino.h>
+#include <WiFiServer.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*******************************************************************************
+ **                           WIFICLIENT / WIFISERVER                          **
+ *******************************************************************************/
+
+static void setNonBlocking(int fd)
+{
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+WiFiClient::Socket::~Socket()
+{
+  if (fd >= 0)
+    ::close(fd);
+}
+
+WiFiClient::WiFiClient(int fd)
+{
+  if (fd >= 0)
+  {
+    setNonBlocking(fd);
+    sock_ = std::make_shared<Socket>();
+    sock_->fd = fd;
+  }
+}
+
+int WiFiClient::connect(IPAddress ip, uint16_t port)
+{
+  return connect(ip, port, timeout_);
+}
+
+int WiFiClient::connect(IPAddress ip, uint16_t port, int32_t timeout_ms)
+{
+  stop();
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return 0;
+  setNonBlocking(fd);
+  sockaddr_in sa = {};
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = (uint32_t)ip;
+  if (::connect(fd, (sockaddr *)&sa, sizeof(sa)) < 0 && errno != EINPROGRESS)
+  {
+    ::close(fd);
+    return 0;
+  }
+  pollfd pfd = {fd, POLLOUT, 0};
+  int err = 0;
+  socklen_t len = sizeof(err);
+  if (poll(&pfd, 1, timeout_ms) <= 0 ||
+      getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+  {
+    ::close(fd);
+    return 0;
+  }
+  sock_ = std::make_shared<Socket>();
+  sock_->fd = fd;
+  return 1;
+}
+
+size_t WiFiClient::write(const uint8_t *buf, size_t size)
+{
+  // Like the ESP cores, block until everything is queued or the peer is gone
+  size_t sent = 0;
+  while (sent < size && fd() >= 0)
+  {
+    ssize_t n = send(fd(), buf + sent, size - sent, MSG_NOSIGNAL);
+    if (n > 0)
+      sent += n;
+    else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      pollfd pfd = {fd(), POLLOUT, 0};
+      if (poll(&pfd, 1, timeout_) <= 0)
+        break;
+    }
+    else
+      break;
+  }
+  return sent;
+}
+
+int WiFiClient::availableForWrite()
+{
+  if (fd() < 0)
+    return 0;
+  int sndbuf = 0, queued = 0;
+  socklen_t len = sizeof(sndbuf);
+  getsockopt(fd(), SOL_SOCKET, SO_SNDBUF, &sndbuf, &len);
+  ioctl(fd(), SIOCOUTQ, &queued);
+  // The kernel doubles SO_SNDBUF for bookkeeping, half of it is payload
+  int room = sndbuf / 2 - queued;
+  return room > 0 ? room : 0;
+}
+
+int WiFiClient::available()
+{
+  if (fd() < 0)
+    return 0;
+  int n = 0;
+  if (ioctl(fd(), FIONREAD, &n) < 0)
+    return 0;
+  return n;
+}
+
+int WiFiClient::read()
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t *buf, size_t size)
+{
+  if (fd() < 0)
+    return -1;
+  ssize_t n = recv(fd(), buf, size, 0);
+  return n < 0 ? -1 : (int)n;
+}
+
+int WiFiClient::peek()
+{
+  uint8_t c;
+  if (fd() < 0 || recv(fd(), &c, 1, MSG_PEEK) != 1)
+    return -1;
+  return c;
+}
+
+void WiFiClient::stop()
+{
+  if (sock_ && sock_->fd >= 0)
+  {
+    ::close(sock_->fd);
+    sock_->fd = -1;
+  }
+  sock_.reset();
+}
+
+uint8_t WiFiClient::connected()
+{
+  if (fd() < 0)
+    return 0;
+  if (available() > 0)
+    return 1;
+  uint8_t c;
+  ssize_t n = recv(fd(), &c, 1, MSG_PEEK);
+  if (n == 0)
+    return 0;
+  if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+    return 0;
+  return 1;
+}
+
+void WiFiClient::setNoDelay(bool nodelay)
+{
+  int v = nodelay;
+  if (fd() >= 0)
+    setsockopt(fd(), IPPROTO_TCP, TCP_NODELAY, &v, sizeof(v));
+}
+
+IPAddress WiFiClient::remoteIP()
+{
+  sockaddr_in sa = {};
+  socklen_t len = sizeof(sa);
+  if (fd() < 0 || getpeername(fd(), (sockaddr *)&sa, &len) < 0)
+    return IPAddress();
+  return IPAddress((uint32_t)sa.sin_addr.s_addr);
+}
+
+uint16_t WiFiClient::remotePort()
+{
+  sockaddr_in sa = {};
+  socklen_t len = sizeof(sa);
+  if (fd() < 0 || getpeername(fd(), (sockaddr *)&sa, &len) < 0)
+    return 0;
+  return ntohs(sa.sin_port);
+}
+
+IPAddress WiFiClient::localIP()
+{
+  sockaddr_in sa = {};
+  socklen_t len = sizeof(sa);
+  if (fd() < 0 || getsockname(fd(), (sockaddr *)&sa, &len) < 0)
+    return IPAddress();
+  return IPAddress((uint32_t)sa.sin_addr.s_addr);
+}
+
+uint16_t WiFiClient::localPort()
+{
+  sockaddr_in sa = {};
+  socklen_t len = sizeof(sa);
+  if (fd() < 0 || getsockname(fd(), (sockaddr *)&sa, &len) < 0)
+    return 0;
+  return ntohs(sa.sin_port);
+}
+
+void WiFiServer::begin()
+{
+  stop();
+  fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd_ < 0)
+    return;
+  int one = 1;
+  setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in sa = {};
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port_);
+  sa.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(fd_, (sockaddr *)&sa, sizeof(sa)) < 0 || listen(fd_, 64) < 0)
+  {
+    perror("WiFiServer::begin");
+    ::close(fd_);
+    fd_ = -1;
+    return;
+  }
+  setNonBlocking(fd_);
+}
+
+void WiFiServer::stop()
+{
+  if (fd_ >= 0)
+    ::close(fd_);
+  fd_ = -1;
+}
+
+bool WiFiServer::hasClient()
+{
+  if (fd_ < 0)
+    return false;
+  pollfd pfd = {fd_, POLLIN, 0};
+  return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
+
+WiFiClient WiFiServer::accept()
+{
+  if (fd_ < 0)
+    return WiFiClient();
+  int fd = ::accept(fd_, nullptr, nullptr);
+  if (fd < 0)
+    return WiFiClient();
+  WiFiClient c(fd);
+  if (noDelay_)
+    c.setNoDelay(true);
+  return c;
+}
@@ -0,0 +1,481 @@
+/*
+ * Host (Linux) implementation of the Arduino stand-ins used to build
+ * FtpServer on a workstation. The network is in HostNet.cpp, which the
+ * simulator (extras/sim) replaces.
+ */
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <Update.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <new>
+#include <thread>
+
+/*******************************************************************************
+ **                               ARDUINO CORE                                 **
+ *******************************************************************************/
+
+static const auto hostEpoch = std::chrono::steady_clock::now();
+
+unsigned long millis()
+{
+  return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now() - hostEpoch)
+      .count();
+}
+
+unsigned long micros()
+{
+  return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - hostEpoch)
+      .count();
+}
+
+void delay(unsigned long ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void yield()
+{
+  std::this_thread::yield();
+}
+
+EspClass ESP;
+
+uint32_t hostFreeHeap()
+{
+  struct mallinfo2 mi = mallinfo2();
+  return (uint32_t)mi.fordblks;
+}
+
+size_t Print::printf(const char *format, ...)
+{
+  char tmp[256];
+  va_list ap;
+  va_start(ap, format);
+  int n = vsnprintf(tmp, sizeof(tmp), format, ap);
+  va_end(ap);
+  if (n < 0)
+    return 0;
+  return write((const uint8_t *)tmp, (size_t)n < sizeof(tmp) ? n : sizeof(tmp) - 1);
+}
+
+#if defined(FTP_PROFILE) && FTP_PROFILE
+// String is a std::string here, allocated by the operator new of the shared
+// libstdc++ that -Wl,--wrap=malloc doesn't reach. This one calls the
+// malloc() of the program, counted by FtpProfile.
+void *operator new(size_t size)
+{
+  void *p = malloc(size ? size : 1);
+  if (p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+#endif
+
+/*******************************************************************************
+ **                                  LITTLEFS                                  **
+ *******************************************************************************/
+
+fs::FS LittleFS;
+
+namespace fs
+{
+
+File::Impl::~Impl()
+{
+  if (fp)
+    fclose(fp);
+  if (dir)
+    closedir(dir);
+}
+
+size_t File::write(const uint8_t *buf, size_t size)
+{
+  if (!impl_ || !impl_->fp)
+    return 0;
+  return fwrite(buf, 1, size, impl_->fp);
+}
+
+int File::available()
+{
+  if (!impl_ || !impl_->fp)
+    return 0;
+  return (int)(size() - position());
+}
+
+int File::read()
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+size_t File::read(uint8_t *buf, size_t size)
+{
+  if (!impl_ || !impl_->fp)
+    return 0;
+  return fread(buf, 1, size, impl_->fp);
+}
+
+int File::peek()
+{
+  if (!impl_ || !impl_->fp)
+    return -1;
+  int c = fgetc(impl_->fp);
+  if (c != EOF)
+    ungetc(c, impl_->fp);
+  return c == EOF ? -1 : c;
+}
+
+void File::flush()
+{
+  if (impl_ && impl_->fp)
+    fflush(impl_->fp);
+}
+
+bool File::seek(uint32_t pos, SeekMode mode)
+{
+  if (!impl_ || !impl_->fp)
+    return false;
+  return fseek(impl_->fp, pos, mode == SeekSet ? SEEK_SET : mode == SeekCur ? SEEK_CUR : SEEK_END) == 0;
+}
+
+size_t File::position() const
+{
+  if (!impl_ || !impl_->fp)
+    return 0;
+  return ftell(impl_->fp);
+}
+
+size_t File::size() const
+{
+  if (!impl_ || !impl_->fp)
+    return 0;
+  fflush(impl_->fp);
+  struct stat st;
+  if (fstat(fileno(impl_->fp), &st) < 0)
+    return 0;
+  return st.st_size;
+}
+
+bool File::truncate(uint32_t size)
+{
+  if (!impl_ || !impl_->fp)
+    return false;
+  fflush(impl_->fp);
+  return ftruncate(fileno(impl_->fp), size) == 0;
+}
+
+void File::close()
+{
+  impl_.reset();
+}
+
+const char *File::name() const
+{
+  if (!impl_)
+    return "";
+  const char *p = strrchr(impl_->path.c_str(), '/');
+  return p && p[1] ? p + 1 : impl_->path.c_str();
+}
+
+const char *File::path() const
+{
+  return impl_ ? impl_->path.c_str() : "";
+}
+
+time_t File::getLastWrite()
+{
+  struct stat st;
+  if (!impl_ || stat(impl_->realPath.c_str(), &st) < 0)
+    return 0;
+  return st.st_mtime;
+}
+
+static bool nextEntry(DIR *dir, struct dirent *&de)
+{
+  while ((de = readdir(dir)) != nullptr)
+    if (strcmp(de->d_name, ".") && strcmp(de->d_name, ".."))
+      return true;
+  return false;
+}
+
+static String joinPath(const String &dir, const char *name)
+{
+  String p = dir;
+  if (!p.endsWith("/"))
+    p += "/";
+  p += name;
+  return p;
+}
+
+File File::openNextFile(const char *mode)
+{
+  struct dirent *de;
+  if (!impl_ || !impl_->dir || !nextEntry(impl_->dir, de))
+    return File();
+  return LittleFS.open(joinPath(impl_->path, de->d_name).c_str(), mode);
+}
+
+String File::getNextFileName()
+{
+  return getNextFileName(nullptr);
+}
+
+String File::getNextFileName(bool *isDir)
+{
+  struct dirent *de;
+  if (!impl_ || !impl_->dir || !nextEntry(impl_->dir, de))
+    return String();
+  if (isDir)
+    *isDir = de->d_type == DT_DIR;
+  return joinPath(impl_->path, de->d_name);
+}
+
+void File::rewindDirectory()
+{
+  if (impl_ && impl_->dir)
+    rewinddir(impl_->dir);
+}
+
+bool Dir::next()
+{
+  struct dirent *de;
+  if (!dir_ || !nextEntry(dir_.get(), de))
+    return false;
+  name_ = de->d_name;
+  struct stat st;
+  String real = fs_->hostPath(joinPath(path_, de->d_name).c_str());
+  if (stat(real.c_str(), &st) == 0)
+  {
+    size_ = S_ISDIR(st.st_mode) ? 0 : st.st_size;
+    mtime_ = st.st_mtime;
+    isDir_ = S_ISDIR(st.st_mode);
+  }
+  return true;
+}
+
+File Dir::openFile(const char *mode)
+{
+  return fs_->open(joinPath(path_, name_.c_str()).c_str(), mode);
+}
+
+bool Dir::rewind()
+{
+  if (!dir_)
+    return false;
+  rewinddir(dir_.get());
+  return true;
+}
+
+bool FS::begin(const char *hostRoot)
+{
+  root_ = hostRoot;
+  while (root_.length() > 1 && root_.endsWith("/"))
+    root_.remove(root_.length() - 1);
+  struct stat st;
+  return stat(root_.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+String FS::hostPath(const char *path) const
+{
+  if (path[0] != '/')
+    return root_ + "/" + path;
+  return root_ + path;
+}
+
+File FS::open(const char *path, const char *mode, bool create)
+{
+  (void)create;
+  File f;
+  String real = hostPath(path);
+  struct stat st;
+  if (stat(real.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+  {
+    DIR *d = opendir(real.c_str());
+    if (!d)
+      return f;
+    f.impl_ = std::make_shared<File::Impl>();
+    f.impl_->dir = d;
+  }
+  else
+  {
+    // The device opens "r+" on a missing file as an error, so does fopen
+    FILE *fp = fopen(real.c_str(), mode);
+    if (!fp)
+      return f;
+    // and its write() returns what reached the file system: unbuffered,
+    // a full disk shows in the count and not at fclose()
+    if (mode[0] != 'r' || mode[1] == '+')
+      setvbuf(fp, NULL, _IONBF, 0);
+    f.impl_ = std::make_shared<File::Impl>();
+    f.impl_->fp = fp;
+  }
+  f.impl_->path = path[0] == '/' ? String(path) : String("/") + path;
+  f.impl_->realPath = real;
+  return f;
+}
+
+bool FS::exists(const char *path)
+{
+  struct stat st;
+  return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool FS::remove(const char *path)
+{
+  return unlink(hostPath(path).c_str()) == 0;
+}
+
+bool FS::rename(const char *from, const char *to)
+{
+  return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+}
+
+bool FS::mkdir(const char *path)
+{
+  return ::mkdir(hostPath(path).c_str(), 0755) == 0;
+}
+
+bool FS::rmdir(const char *path)
+{
+  return ::rmdir(hostPath(path).c_str()) == 0;
+}
+
+size_t FS::totalBytes()
+{
+  struct statvfs sv;
+  if (statvfs(root_.c_str(), &sv) < 0)
+    return 0;
+  return (size_t)sv.f_blocks * sv.f_frsize;
+}
+
+size_t FS::usedBytes()
+{
+  struct statvfs sv;
+  if (statvfs(root_.c_str(), &sv) < 0)
+    return 0;
+  return (size_t)(sv.f_blocks - sv.f_bavail) * sv.f_frsize;
+}
+
+bool FS::info(FSInfo &info)
+{
+  info.totalBytes = totalBytes();
+  info.usedBytes = usedBytes();
+  info.blockSize = 4096;
+  info.pageSize = 256;
+  info.maxOpenFiles = 16;
+  info.maxPathLength = 255;
+  return true;
+}
+
+Dir FS::openDir(const char *path)
+{
+  Dir d;
+  DIR *h = opendir(hostPath(path).c_str());
+  if (h)
+    d.dir_ = std::shared_ptr<DIR>(h, closedir);
+  d.fs_ = this;
+  d.path_ = path;
+  return d;
+}
+
+} // namespace fs
+
+/*******************************************************************************
+ **                                   UPDATE                                   **
+ *******************************************************************************/
+
+UpdateClass Update;
+
+void UpdateClass::fail(const char *error)
+{
+  snprintf(error_, sizeof(error_), "%s", error);
+}
+
+bool UpdateClass::begin(size_t size, int command)
+{
+  (void)command;
+  error_[0] = 0;
+  if (fp_ != NULL)
+  {
+    fail("Update already running");
+    return false;
+  }
+  if (target_.length() == 0)
+  {
+    fail("No OTA partition (ftphost -u <file>)");
+    return false;
+  }
+  fp_ = fopen((target_ + ".new").c_str(), "wb");
+  if (fp_ == NULL)
+  {
+    fail(strerror(errno));
+    return false;
+  }
+  size_ = size;
+  progress_ = 0;
+  return true;
+}
+
+size_t UpdateClass::write(uint8_t *data, size_t len)
+{
+  if (fp_ == NULL || hasError())
+    return 0;
+  if (size_ != UPDATE_SIZE_UNKNOWN && progress_ + len > size_)
+  {
+    fail("Image larger than announced");
+    return 0;
+  }
+  size_t n = fwrite(data, 1, len, fp_);
+  progress_ += n;
+  if (n < len)
+    fail("Flash write failed");
+  return n;
+}
+
+bool UpdateClass::end(bool evenIfRemaining)
+{
+  if (fp_ == NULL)
+  {
+    fail("Update not running");
+    return false;
+  }
+  bool ok = !hasError() && progress_ > 0 &&
+            (evenIfRemaining || size_ == UPDATE_SIZE_UNKNOWN || progress_ == size_);
+  fclose(fp_);
+  fp_ = NULL;
+  String tmp = target_ + ".new";
+  if (ok && rename(tmp.c_str(), target_.c_str()) == 0)
+    return true;
+  if (!hasError())
+    fail(progress_ == 0 ? "Empty image" : "Image incomplete");
+  unlink(tmp.c_str());
+  return false;
+}
+
+void UpdateClass::abort()
+{
+  if (fp_ != NULL)
+  {
+    fclose(fp_);
+    fp_ = NULL;
+    unlink((target_ + ".new").c_str());
+  }
+  fail("Aborted");
+}
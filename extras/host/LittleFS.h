@@ -0,0 +1,152 @@
+/*
+ * Host (Linux) stand-in for the LittleFS / FS API
+ *
+ * Maps the device file system onto a directory of the host. Both the
+ * ESP32 interface (File::openNextFile, totalBytes/usedBytes) and the
+ * ESP8266 one (Dir, FSInfo) are provided so either branch of the
+ * library can be compiled against it.
+ */
+
+#ifndef FTP_HOST_LITTLEFS_H
+#define FTP_HOST_LITTLEFS_H
+
+#include <dirent.h>
+#include <memory>
+
+#include "Arduino.h"
+
+namespace fs
+{
+
+enum SeekMode
+{
+  SeekSet = 0,
+  SeekCur = 1,
+  SeekEnd = 2
+};
+
+struct FSInfo
+{
+  size_t totalBytes;
+  size_t usedBytes;
+  size_t blockSize;
+  size_t pageSize;
+  size_t maxOpenFiles;
+  size_t maxPathLength;
+};
+
+class FS;
+
+class File : public Stream
+{
+public:
+  File() {}
+
+  size_t write(const uint8_t *buf, size_t size) override;
+  using Print::write;
+  int available() override;
+  int read() override;
+  size_t read(uint8_t *buf, size_t size);
+  size_t readBytes(char *buf, size_t size) { return read((uint8_t *)buf, size); }
+  int peek() override;
+  void flush() override;
+  bool seek(uint32_t pos, SeekMode mode = SeekSet);
+  size_t position() const;
+  size_t size() const;
+  bool truncate(uint32_t size);
+  void close();
+  operator bool() const { return impl_ && (impl_->fp || impl_->dir); }
+  const char *name() const;
+  const char *path() const;
+  const char *fullName() const { return path(); }
+  bool isDirectory() const { return impl_ && impl_->dir; }
+  bool isFile() const { return impl_ && impl_->fp; }
+  time_t getLastWrite();
+  time_t getCreationTime() { return getLastWrite(); }
+  File openNextFile(const char *mode = "r");
+  String getNextFileName();
+  String getNextFileName(bool *isDir);
+  void rewindDirectory();
+
+private:
+  friend class FS;
+  struct Impl
+  {
+    FILE *fp = nullptr;
+    DIR *dir = nullptr;
+    String path;     // path as seen by the sketch
+    String realPath; // path on the host
+    ~Impl();
+  };
+  std::shared_ptr<Impl> impl_;
+};
+
+class Dir
+{
+public:
+  bool next();
+  String fileName() const { return name_; }
+  size_t fileSize() const { return size_; }
+  time_t fileTime() const { return mtime_; }
+  time_t fileCreationTime() const { return mtime_; }
+  bool isFile() const { return !isDir_; }
+  bool isDirectory() const { return isDir_; }
+  File openFile(const char *mode);
+  bool rewind();
+
+private:
+  friend class FS;
+  std::shared_ptr<DIR> dir_;
+  FS *fs_ = nullptr;
+  String path_, name_;
+  size_t size_ = 0;
+  time_t mtime_ = 0;
+  bool isDir_ = false;
+};
+
+class FS
+{
+public:
+  // Host only: serve the sketch's "/" from this directory of the host
+  bool begin(const char *hostRoot);
+  bool begin() { return begin("."); }
+  void end() {}
+  const char *hostRoot() const { return root_.c_str(); }
+  String hostPath(const char *path) const;
+
+  File open(const char *path, const char *mode = "r", bool create = false);
+  File open(const String &path, const char *mode = "r") { return open(path.c_str(), mode); }
+  bool exists(const char *path);
+  bool exists(const String &path) { return exists(path.c_str()); }
+  bool remove(const char *path);
+  bool remove(const String &path) { return remove(path.c_str()); }
+  bool rename(const char *from, const char *to);
+  bool rename(const String &from, const String &to) { return rename(from.c_str(), to.c_str()); }
+  bool mkdir(const char *path);
+  bool mkdir(const String &path) { return mkdir(path.c_str()); }
+  bool rmdir(const char *path);
+  bool rmdir(const String &path) { return rmdir(path.c_str()); }
+  size_t totalBytes();
+  size_t usedBytes();
+  bool info(FSInfo &info);
+  Dir openDir(const char *path);
+  Dir openDir(const String &path) { return openDir(path.c_str()); }
+
+private:
+  String root_;
+};
+
+} // namespace fs
+
+using fs::Dir;
+using fs::File;
+using fs::FS;
+using fs::FSInfo;
+using fs::SeekCur;
+using fs::SeekEnd;
+using fs::SeekMode;
+using fs::SeekSet;
+
+extern fs::FS LittleFS;
+
+#endif // FTP_HOST_LITTLEFS_H
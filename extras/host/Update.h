@@ -0,0 +1,46 @@
+/*
+ * Host (Linux) stand-in for the Update API of the ESP32 core (Update.h)
+ * and of the ESP8266 core (Updater.h)
+ *
+ * The "OTA partition" is a file of the host given to hostTarget(), the
+ * image is written next to it and only renamed over it by end(), like
+ * the boot partition is only switched once the image is complete.
+ */
+
+#ifndef FTP_HOST_UPDATE_H
+#define FTP_HOST_UPDATE_H
+
+#include "Arduino.h"
+
+#define UPDATE_SIZE_UNKNOWN 0xFFFFFFFF
+#define U_FLASH 0
+
+class UpdateClass
+{
+public:
+  void hostTarget(const char *path) { target_ = path ? path : ""; }
+
+  bool begin(size_t size = UPDATE_SIZE_UNKNOWN, int command = U_FLASH);
+  size_t write(uint8_t *data, size_t len);
+  bool end(bool evenIfRemaining = false);
+  void abort();
+
+  bool isRunning() { return fp_ != NULL; }
+  bool hasError() { return error_[0] != 0; }
+  const char *errorString() { return error_; }  // ESP32
+  String getErrorString() { return error_; }    // ESP8266
+  size_t progress() { return progress_; }
+
+private:
+  void fail(const char *error);
+
+  String target_;
+  FILE *fp_ = NULL;
+  size_t size_ = 0;
+  size_t progress_ = 0;
+  char error_[64] = "";
+};
+
+extern UpdateClass Update;
+
+#endif // FTP_HOST_UPDATE_H
@@ -0,0 +1,10 @@
+/*
+ * Host (Linux) stand-in for the ESP8266 Updater.h header
+ */
+
+#ifndef FTP_HOST_UPDATER_H
+#define FTP_HOST_UPDATER_H
+
+#include "Update.h"
+
+#endif // FTP_HOST_UPDATER_H
@@ -0,0 +1,159 @@
+/*
+ * Host (Linux) stand-in for the Arduino String class
+ *
+ * Only the subset used by the FTP server is provided. Numeric
+ * constructors are explicit, like on the ESP cores, so that
+ * "text" + String(n) behaves the same on the host and on the device.
+ */
+
+#ifndef FTP_HOST_WSTRING_H
+#define FTP_HOST_WSTRING_H
+
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cctype>
+
+class String
+{
+public:
+  String() {}
+  String(const char *s) : s_(s ? s : "") {}
+  String(const std::string &s) : s_(s) {}
+  explicit String(char c) : s_(1, c) {}
+  explicit String(int v, unsigned char base = 10) { fromLong(v, base); }
+  explicit String(unsigned int v, unsigned char base = 10) { fromULong(v, base); }
+  explicit String(long v, unsigned char base = 10) { fromLong(v, base); }
+  explicit String(unsigned long v, unsigned char base = 10) { fromULong(v, base); }
+  explicit String(long long v, unsigned char base = 10) { fromLong(v, base); }
+  explicit String(unsigned long long v, unsigned char base = 10) { fromULong(v, base); }
+  explicit String(unsigned char v, unsigned char base = 10) { fromULong(v, base); }
+  explicit String(float v, unsigned char decimals = 2) { fromDouble(v, decimals); }
+  explicit String(double v, unsigned char decimals = 2) { fromDouble(v, decimals); }
+
+  const char *c_str() const { return s_.c_str(); }
+  unsigned int length() const { return s_.length(); }
+  bool reserve(unsigned int size)
+  {
+    s_.reserve(size);
+    return true;
+  }
+  char operator[](unsigned int i) const { return i < s_.length() ? s_[i] : 0; }
+  char &operator[](unsigned int i) { return s_[i]; }
+
+  String &operator+=(const String &rhs)
+  {
+    s_ += rhs.s_;
+    return *this;
+  }
+  String &operator+=(const char *rhs)
+  {
+    s_ += rhs;
+    return *this;
+  }
+  String &operator+=(char c)
+  {
+    s_ += c;
+    return *this;
+  }
+
+  bool operator==(const String &rhs) const { return s_ == rhs.s_; }
+  bool operator!=(const String &rhs) const { return s_ != rhs.s_; }
+  bool operator==(const char *rhs) const { return s_ == rhs; }
+  bool operator!=(const char *rhs) const { return s_ != rhs; }
+
+  int indexOf(char c, unsigned int from = 0) const
+  {
+    size_t p = s_.find(c, from);
+    return p == std::string::npos ? -1 : (int)p;
+  }
+  int indexOf(const String &str, unsigned int from = 0) const
+  {
+    size_t p = s_.find(str.s_, from);
+    return p == std::string::npos ? -1 : (int)p;
+  }
+  int lastIndexOf(char c) const
+  {
+    size_t p = s_.rfind(c);
+    return p == std::string::npos ? -1 : (int)p;
+  }
+  String substring(unsigned int from) const
+  {
+    return from < s_.length() ? String(s_.substr(from)) : String();
+  }
+  String substring(unsigned int from, unsigned int to) const
+  {
+    if (from > to || from >= s_.length())
+      return String();
+    return String(s_.substr(from, to - from));
+  }
+  bool startsWith(const String &p) const { return s_.compare(0, p.s_.length(), p.s_) == 0; }
+  bool endsWith(const String &p) const
+  {
+    return s_.length() >= p.s_.length() &&
+           s_.compare(s_.length() - p.s_.length(), p.s_.length(), p.s_) == 0;
+  }
+  void remove(unsigned int index) { remove(index, (unsigned int)-1); }
+  void remove(unsigned int index, unsigned int count)
+  {
+    if (index < s_.length())
+      s_.erase(index, count);
+  }
+  long toInt() const { return atol(s_.c_str()); }
+  void toUpperCase()
+  {
+    for (auto &c : s_)
+      c = toupper((unsigned char)c);
+  }
+  void trim()
+  {
+    size_t b = s_.find_first_not_of(" \t\r\n");
+    size_t e = s_.find_last_not_of(" \t\r\n");
+    s_ = b == std::string::npos ? std::string() : s_.substr(b, e - b + 1);
+  }
+
+  friend String operator+(const String &a, const String &b) { return String(a.s_ + b.s_); }
+  friend String operator+(const String &a, const char *b) { return String(a.s_ + b); }
+  friend String operator+(const char *a, const String &b) { return String(a + b.s_); }
+  friend String operator+(const String &a, char b) { return String(a.s_ + b); }
+  friend String operator+(const String &a, int b) { return a + String(b); }
+  friend String operator+(const String &a, unsigned int b) { return a + String(b); }
+  friend String operator+(const String &a, long b) { return a + String(b); }
+  friend String operator+(const String &a, unsigned long b) { return a + String(b); }
+
+private:
+  void fromLong(long long v, unsigned char base)
+  {
+    if (v < 0 && base == 10)
+    {
+      fromULong((unsigned long long)(-v), base);
+      s_.insert(s_.begin(), '-');
+    }
+    else
+      fromULong((unsigned long long)v, base);
+  }
+  void fromULong(unsigned long long v, unsigned char base)
+  {
+    char tmp[66];
+    char *p = tmp + sizeof(tmp) - 1;
+    *p = 0;
+    do
+    {
+      unsigned d = v % base;
+      *--p = d < 10 ? '0' + d : 'a' + d - 10;
+      v /= base;
+    } while (v);
+    s_ = p;
+  }
+  void fromDouble(double v, unsigned char decimals)
+  {
+    char tmp[64];
+    snprintf(tmp, sizeof(tmp), "%.*f", decimals, v);
+    s_ = tmp;
+  }
+
+  std::string s_;
+};
+
+#endif // FTP_HOST_WSTRING_H
@@ -0,0 +1,11 @@
+/*
+ * Host (Linux) stand-in for the ESP32 WiFi.h header
+ */
+
+#ifndef FTP_HOST_WIFI_H
+#define FTP_HOST_WIFI_H
+
+#include "WiFiClient.h"
+#include "WiFiServer.h"
+
+#endif // FTP_HOST_WIFI_H
@@ -0,0 +1,68 @@
+/*
+ * Host (Linux) stand-in for WiFiClient
+ *
+ * Non-blocking BSD sockets behind the ESP32 WiFiClient API. Copies of a
+ * WiFiClient share the same socket, as on the device, and stop() closes
+ * it for every copy.
+ */
+
+#ifndef FTP_HOST_WIFICLIENT_H
+#define FTP_HOST_WIFICLIENT_H
+
+#include <memory>
+
+#include "Arduino.h"
+
+class Client : public Stream
+{
+public:
+  virtual int connect(IPAddress ip, uint16_t port) = 0;
+  virtual int read(uint8_t *buf, size_t size) = 0;
+  virtual void stop() = 0;
+  virtual uint8_t connected() = 0;
+  virtual operator bool() = 0;
+  using Stream::read;
+  using Print::write;
+};
+
+class WiFiClient : public Client
+{
+public:
+  WiFiClient() {}
+  explicit WiFiClient(int fd);
+
+  int connect(IPAddress ip, uint16_t port) override;
+  int connect(IPAddress ip, uint16_t port, int32_t timeout_ms);
+  size_t write(const uint8_t *buf, size_t size) override;
+  int availableForWrite() override;
+  int available() override;
+  int read() override;
+  int read(uint8_t *buf, size_t size) override;
+  size_t readBytes(char *buf, size_t size) { return read((uint8_t *)buf, size); }
+  int peek() override;
+  void flush() override {}
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override { return fd() >= 0; }
+  void setNoDelay(bool nodelay);
+  void setTimeout(uint32_t ms) { timeout_ = ms; }
+
+  IPAddress remoteIP();
+  uint16_t remotePort();
+  IPAddress localIP();
+  uint16_t localPort();
+
+  // Host only: underlying descriptor, -1 when closed
+  int fd() const { return sock_ ? sock_->fd : -1; }
+
+private:
+  struct Socket
+  {
+    int fd = -1;
+    ~Socket();
+  };
+  std::shared_ptr<Socket> sock_;
+  uint32_t timeout_ = 5000;
+};
+
+#endif // FTP_HOST_WIFICLIENT_H
@@ -0,0 +1,35 @@
+/*
+ * Host (Linux) stand-in for WiFiServer
+ *
+ * A listening BSD socket behind the ESP32 WiFiServer API.
+ */
+
+#ifndef FTP_HOST_WIFISERVER_H
+#define FTP_HOST_WIFISERVER_H
+
+#include "WiFiClient.h"
+
+class WiFiServer
+{
+public:
+  explicit WiFiServer(uint16_t port) : port_(port) {}
+  void begin();
+  void begin(uint16_t port)
+  {
+    port_ = port;
+    begin();
+  }
+  void stop();
+  bool hasClient();
+  WiFiClient accept();
+  WiFiClient available() { return accept(); }
+  uint16_t port() const { return port_; }
+  void setNoDelay(bool nodelay) { noDelay_ = nodelay; }
+
+private:
+  uint16_t port_;
+  int fd_ = -1;
+  bool noDelay_ = false;
+};
+
+#endif // FTP_HOST_WIFISERVER_H
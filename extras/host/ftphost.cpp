@@ -0,0 +1,137 @@
+/*
+ * Host build of FtpServer
+ *
+ * Runs the library unchanged on Linux against the stand-ins of this
+ * directory, serving a directory of the workstation. Used as the target
+ * of extras/ftpload and for profiling changes to handleFTP().
+ *
+ *   usage: ftphost [-n servers] [-c cache_bytes] [-u ota_file] [-v]
+ *                  [-t cert.pem -k key.pem [-s]] <root dir> [user] [password]
+ *
+ * -n runs several servers, hence sessions, sharing the control port, as a
+ * sketch with an array of FtpServer would (segmented transfers).
+ *
+ * -u gives the file that stands for the OTA partition: a STOR to
+ * FTP_OTA_PATH replaces it once the image is complete and verified.
+ * -v adds two virtual files: /status.txt, of known size, and /samples.csv,
+ * of unknown size.
+ * -t and -k enable explicit FTPS with OpenSSL, -s makes it mandatory.
+ */
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <Update.h>
+#include "FtpTlsOpenSSL.h"
+#include <unistd.h>
+
+#include "FtpServer.h"
+
+#define MAX_SERVERS 8
+
+FtpServer ftpSrv[MAX_SERVERS];
+FtpTlsOpenSSL tls;
+
+static String status;
+
+static uint32_t statusSize(void *)
+{
+  status = "uptime " + String(millis()) + " ms\nfree heap " + String(hostFreeHeap()) + "\n";
+  return status.length();
+}
+
+static size_t statusRead(uint32_t offset, uint8_t *buf, size_t len, void *)
+{
+  if (offset == 0)
+    statusSize(NULL);
+  if (offset >= status.length())
+    return 0;
+  if (len > status.length() - offset)
+    len = status.length() - offset;
+  memcpy(buf, status.c_str() + offset, len);
+  return len;
+}
+
+// 1000 lines "<index>,<value>" generated on the fly, a whole line at a time
+static size_t samplesRead(uint32_t offset, uint8_t *buf, size_t len, void *)
+{
+  static uint32_t line;
+  if (offset == 0)
+    line = 0;
+  size_t n = 0;
+  char text[32];
+  while (line < 1000)
+  {
+    int l = snprintf(text, sizeof(text), "%u,%u\n", line, (line * 7919) % 1000);
+    if (n + l > len)
+      break;
+    memcpy(buf + n, text, l);
+    n += l;
+    line++;
+  }
+  return n;
+}
+
+int main(int argc, char **argv)
+{
+  int c;
+  const char *cert = NULL, *key = NULL;
+  bool tlsRequired = false;
+  int servers = 1;
+  while ((c = getopt(argc, argv, "n:c:u:vt:k:s")) != -1)
+  {
+    if (c == 'n')
+      servers = atoi(optarg);
+    else if (c == 'c')
+      FtpServer::setCacheSize(strtoul(optarg, NULL, 10));
+    else if (c == 'u')
+      Update.hostTarget(optarg);
+    else if (c == 'v')
+    {
+      FtpServer::addVirtualFile("/status.txt", statusRead, statusSize);
+      FtpServer::addVirtualFile("/samples.csv", samplesRead);
+    }
+    else if (c == 't')
+      cert = optarg;
+    else if (c == 'k')
+      key = optarg;
+    else if (c == 's')
+      tlsRequired = true;
+    else
+      return 1;
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+  if (argc < 2 || (cert == NULL) != (key == NULL) || servers < 1 || servers > MAX_SERVERS)
+  {
+    fprintf(stderr, "usage: %s [-n servers] [-c cache_bytes] [-u ota_file] [-v] [-t cert.pem -k key.pem [-s]] "
+                    "<root dir> [user] [password]\n", argv[0]);
+    return 1;
+  }
+  if (cert != NULL)
+  {
+    if (!tls.begin(cert, key))
+      return 1;
+    for (int i = 0; i < servers; i++)
+      ftpSrv[i].setTls(&tls, tlsRequired);
+  }
+  if (!LittleFS.begin(argv[1]))
+  {
+    fprintf(stderr, "%s is not a directory\n", argv[1]);
+    return 1;
+  }
+  for (int i = 0; i < servers; i++)
+    ftpSrv[i].begin(argc > 2 ? argv[2] : "esp", argc > 3 ? argv[3] : "esp");
+  printf("FtpServer %s serving %s on port %d\n", FTP_SERVER_VERSION, argv[1], FTP_CTRL_PORT);
+  fflush(stdout);
+
+  for (;;)
+  {
+    // Spin while a transfer is running, like loop() does on the device,
+    // but give the CPU back when the server is idle
+    bool busy = false;
+    for (int i = 0; i < servers; i++)
+      busy |= ftpSrv[i].handleFTP();
+    if (!busy)
+      usleep(100);
+  }
+}
@@ -0,0 +1,377 @@
+/*
+ * Simulated network, virtual clock and the WiFiClient / WiFiServer over
+ * them. Linked instead of extras/host/HostNet.cpp.
+ */
+
+#include "SimNet.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <random>
+#include <vector>
+
+uint64_t SimNet::nowUs = 0;
+const IPAddress SimNet::deviceIp(10, 0, 0, 1);
+
+static SimLink simLink;
+static std::mt19937 simRandom;
+static uint64_t mediumFree; // the medium is busy until then
+static uint16_t nextPort = 40000;
+
+unsigned long simMillis()
+{
+  return (uint32_t)(SimNet::now() / 1000);
+}
+
+unsigned long simMicros()
+{
+  return (uint32_t)SimNet::now();
+}
+
+/*******************************************************************************
+ **                                   PIPES                                    **
+ *******************************************************************************/
+
+// What one end of a connection writes, on its way to the other
+struct SimPipe
+{
+  std::deque<uint8_t> flight;                         // sent, not arrived
+  std::deque<uint8_t> rx;                             // arrived, not read yet
+  std::deque<std::pair<uint64_t, uint32_t>> segments; // arrival time, size
+  std::deque<std::pair<uint64_t, uint32_t>> acks;     // time the sender learns it, size
+  uint64_t lastArrival = 0;
+  uint64_t finAt = UINT64_MAX; // arrival of the FIN, once the writer has stopped
+  bool fin = false;            // arrived
+  uint32_t unacked = 0;
+  uint32_t sndBuf = 0;
+  uint32_t rcvWnd = 0;
+
+  uint32_t room() const
+  {
+    int64_t snd = (int64_t)sndBuf - unacked;
+    int64_t wnd = (int64_t)rcvWnd - (int64_t)rx.size() - (int64_t)flight.size();
+    int64_t n = std::min(snd, wnd);
+    return n > 0 ? n : 0;
+  }
+
+  void send(const uint8_t *buf, uint32_t size)
+  {
+    while (size > 0)
+    {
+      uint32_t len = std::min<uint32_t>(size, simLink.mss);
+      uint64_t start = std::max(SimNet::now(), mediumFree);
+      mediumFree = start + std::max<uint64_t>(1, (uint64_t)len * 1000000 / simLink.bytesPerSec);
+      uint64_t at = mediumFree + simLink.latencyUs;
+      if (simLink.loss > 0 && std::uniform_real_distribution<double>(0, 1)(simRandom) < simLink.loss)
+        at += std::max<uint64_t>(simLink.rtoUs, 2 * (uint64_t)simLink.latencyUs);
+      // TCP hands the bytes over in order, a late segment holds back the next ones
+      lastArrival = std::max(at, lastArrival);
+      segments.emplace_back(lastArrival, len);
+      flight.insert(flight.end(), buf, buf + len);
+      unacked += len;
+      buf += len;
+      size -= len;
+    }
+  }
+
+  void close()
+  {
+    if (finAt == UINT64_MAX)
+      finAt = std::max(SimNet::now() + simLink.latencyUs, lastArrival);
+  }
+
+  void pump(uint64_t now)
+  {
+    while (!segments.empty() && segments.front().first <= now)
+    {
+      uint32_t len = segments.front().second;
+      rx.insert(rx.end(), flight.begin(), flight.begin() + len);
+      flight.erase(flight.begin(), flight.begin() + len);
+      acks.emplace_back(segments.front().first + simLink.latencyUs, len);
+      segments.pop_front();
+    }
+    while (!acks.empty() && acks.front().first <= now)
+    {
+      unacked -= acks.front().second;
+      acks.pop_front();
+    }
+    if (finAt <= now)
+      fin = true;
+  }
+
+  uint64_t next() const
+  {
+    uint64_t t = fin ? UINT64_MAX : finAt;
+    if (!segments.empty())
+      t = std::min(t, segments.front().first);
+    if (!acks.empty())
+      t = std::min(t, acks.front().first);
+    return t;
+  }
+};
+
+// A connection: end 0 was accepted by a WiFiServer of the device, end 1
+// was opened by a simulated client
+struct SimSocket
+{
+  SimPipe pipe[2]; // pipe[i] carries what end i writes
+  IPAddress ip[2];
+  uint16_t port[2];
+  bool closed[2] = {false, false}; // stop() called by that end
+  enum
+  {
+    synSent,
+    open,
+    refused
+  } state = synSent;
+  uint64_t synAt = 0;  // the SYN reaches the device
+  uint64_t openAt = 0; // the client learns whether it was accepted
+};
+
+static std::vector<std::shared_ptr<SimSocket>> sockets;
+static std::map<uint16_t, std::deque<std::shared_ptr<SimSocket>>> listeners;
+
+/*******************************************************************************
+ **                                   SIMNET                                   **
+ *******************************************************************************/
+
+void SimNet::begin(const SimLink &link, uint32_t seed, uint64_t startUs)
+{
+  simLink = link;
+  simRandom.seed(seed);
+  nowUs = startUs;
+  mediumFree = startUs;
+  nextPort = 40000;
+  sockets.clear();
+  listeners.clear();
+}
+
+void SimNet::advanceTo(uint64_t us)
+{
+  if (us <= nowUs)
+    return;
+  nowUs = us;
+  for (auto &s : sockets)
+  {
+    if (s->state == SimSocket::synSent && s->synAt <= nowUs)
+    {
+      auto l = listeners.find(s->port[0]);
+      if (s->ip[0] == deviceIp && l != listeners.end())
+      {
+        s->state = SimSocket::open;
+        l->second.push_back(s);
+      }
+      else
+        s->state = SimSocket::refused;
+    }
+    s->pipe[0].pump(nowUs);
+    s->pipe[1].pump(nowUs);
+  }
+  // forget the connections no WiFiClient refers to any more
+  sockets.erase(std::remove_if(sockets.begin(), sockets.end(),
+                               [](const std::shared_ptr<SimSocket> &s)
+                               { return s.use_count() == 1; }),
+                sockets.end());
+}
+
+uint64_t SimNet::nextEvent()
+{
+  uint64_t t = UINT64_MAX;
+  for (auto &s : sockets)
+  {
+    if (s->state == SimSocket::synSent)
+      t = std::min(t, s->synAt);
+    if (s->openAt > nowUs)
+      t = std::min(t, s->openAt);
+    t = std::min({t, s->pipe[0].next(), s->pipe[1].next()});
+  }
+  return t;
+}
+
+/*******************************************************************************
+ **                           WIFICLIENT / WIFISERVER                          **
+ *******************************************************************************/
+
+// CPU time of the device for the bytes it moves through a socket
+static void deviceWork(size_t bytes)
+{
+  if (simLink.deviceNsPerByte > 0 && bytes > 0)
+    SimNet::advanceTo(SimNet::now() + (uint64_t)bytes * simLink.deviceNsPerByte / 1000);
+}
+
+WiFiClient::WiFiClient(int fd)
+{
+  if (fd >= 0)
+    ::close(fd);
+}
+
+int WiFiClient::connect(IPAddress ip, uint16_t port)
+{
+  // the simulated clients don't listen: no PORT / EPRT
+  (void)ip;
+  (void)port;
+  stop();
+  return 0;
+}
+
+void WiFiClient::connectStart(IPAddress from, IPAddress ip, uint16_t port)
+{
+  stop();
+  sock_ = std::make_shared<SimSocket>();
+  side_ = 1;
+  SimSocket &s = *sock_;
+  s.ip[0] = ip;
+  s.port[0] = port;
+  s.ip[1] = from;
+  s.port[1] = nextPort++;
+  s.synAt = SimNet::now() + simLink.latencyUs;
+  s.openAt = s.synAt + simLink.latencyUs;
+  s.pipe[0].sndBuf = simLink.deviceWindow;
+  s.pipe[0].rcvWnd = simLink.clientWindow;
+  s.pipe[1].sndBuf = simLink.clientWindow;
+  s.pipe[1].rcvWnd = simLink.deviceWindow;
+  sockets.push_back(sock_);
+}
+
+bool WiFiClient::connecting()
+{
+  return sock_ && SimNet::now() < sock_->openAt;
+}
+
+size_t WiFiClient::write(const uint8_t *buf, size_t size)
+{
+  uint64_t start = SimNet::now();
+  size_t sent = 0;
+  while (sent < size && connected() && !sock_->closed[1 - side_])
+  {
+    SimPipe &out = sock_->pipe[side_];
+    uint32_t n = std::min<size_t>(out.room(), size - sent);
+    out.send(buf + sent, n);
+    sent += n;
+    if (sent == size || side_ == 1)
+      break;
+    // the device waits for its peer to acknowledge
+    uint64_t t = SimNet::nextEvent();
+    if (t == UINT64_MAX || t <= SimNet::now() || t - start > (uint64_t)timeout_ * 1000)
+      break;
+    SimNet::advanceTo(t);
+  }
+  if (side_ == 0)
+    deviceWork(sent);
+  return sent;
+}
+
+int WiFiClient::availableForWrite()
+{
+  return connected() ? sock_->pipe[side_].room() : 0;
+}
+
+int WiFiClient::available()
+{
+  return *this ? sock_->pipe[1 - side_].rx.size() : 0;
+}
+
+int WiFiClient::read()
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t *buf, size_t size)
+{
+  if (!*this)
+    return -1;
+  std::deque<uint8_t> &rx = sock_->pipe[1 - side_].rx;
+  size_t n = std::min(size, rx.size());
+  if (n == 0)
+    return -1;
+  std::copy(rx.begin(), rx.begin() + n, buf);
+  rx.erase(rx.begin(), rx.begin() + n);
+  if (side_ == 0)
+    deviceWork(n);
+  return n;
+}
+
+int WiFiClient::peek()
+{
+  if (!*this || sock_->pipe[1 - side_].rx.empty())
+    return -1;
+  return sock_->pipe[1 - side_].rx.front();
+}
+
+void WiFiClient::stop()
+{
+  if (sock_ && !sock_->closed[side_])
+  {
+    sock_->closed[side_] = true;
+    sock_->pipe[side_].close();
+    sock_->pipe[1 - side_].rx.clear();
+  }
+  sock_.reset();
+}
+
+uint8_t WiFiClient::connected()
+{
+  if (!*this)
+    return 0;
+  if (side_ == 1 && (SimNet::now() < sock_->openAt || sock_->state != SimSocket::open))
+    return 0;
+  const SimPipe &in = sock_->pipe[1 - side_];
+  return !in.rx.empty() || !in.fin;
+}
+
+WiFiClient::operator bool()
+{
+  return sock_ && !sock_->closed[side_];
+}
+
+IPAddress WiFiClient::remoteIP()
+{
+  return sock_ ? sock_->ip[1 - side_] : IPAddress();
+}
+
+uint16_t WiFiClient::remotePort()
+{
+  return sock_ ? sock_->port[1 - side_] : 0;
+}
+
+IPAddress WiFiClient::localIP()
+{
+  return sock_ ? sock_->ip[side_] : IPAddress();
+}
+
+uint16_t WiFiClient::localPort()
+{
+  return sock_ ? sock_->port[side_] : 0;
+}
+
+void WiFiServer::begin()
+{
+  stop();
+  listeners[port_];
+  listening_ = true;
+}
+
+void WiFiServer::stop()
+{
+  if (listening_)
+    listeners.erase(port_);
+  listening_ = false;
+}
+
+bool WiFiServer::hasClient()
+{
+  return listening_ && !listeners[port_].empty();
+}
+
+WiFiClient WiFiServer::accept()
+{
+  if (!hasClient())
+    return WiFiClient();
+  std::shared_ptr<SimSocket> s = listeners[port_].front();
+  listeners[port_].pop_front();
+  return WiFiClient(s, 0);
+}
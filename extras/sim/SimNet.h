@@ -0,0 +1,53 @@
+/*
+ * Simulated network and virtual clock
+ *
+ * Every connection goes through one shared medium, like the stations of a
+ * WiFi network: a segment of at most `mss` bytes waits for the medium,
+ * holds it for size / bandwidth, then arrives `latency` later. A lost
+ * segment arrives after a retransmission timeout, and holds back the ones
+ * behind it. The sender keeps unacknowledged bytes in its send buffer and
+ * never has more than the receiver's window unread on the way.
+ *
+ * Nothing happens between two calls to advanceTo(): the driver runs the
+ * server and the clients, then moves the clock to the next thing due. The
+ * random draws come from one generator seeded by begin(), so a run is
+ * reproduced exactly by its seed.
+ */
+
+#ifndef FTP_SIM_NET_H
+#define FTP_SIM_NET_H
+
+#include "WiFiClient.h"
+#include "WiFiServer.h"
+
+struct SimLink
+{
+  uint32_t latencyUs = 5000;        // one way
+  uint32_t bytesPerSec = 1048576;   // shared by every connection and direction
+  double loss = 0;                  // probability a segment must be sent again
+  uint32_t rtoUs = 200000;          // retransmission timeout, at least 2 latencies
+  uint16_t mss = 1460;
+  uint32_t deviceWindow = 5744;     // TCP_WND and TCP_SND_BUF of lwIP
+  uint32_t clientWindow = 65535;
+  uint32_t deviceNsPerByte = 0;     // CPU of the device, per byte read or written
+};
+
+class SimNet
+{
+public:
+  static void begin(const SimLink &link, uint32_t seed, uint64_t startUs = 0);
+
+  static uint64_t now() { return nowUs; }
+  static void advanceTo(uint64_t us); // delivers everything due until then
+  static uint64_t nextEvent();        // UINT64_MAX if nothing is on the way
+
+  static const IPAddress deviceIp;
+
+private:
+  friend class WiFiClient;
+  friend class WiFiServer;
+
+  static uint64_t nowUs;
+};
+
+#endif // FTP_SIM_NET_H
@@ -0,0 +1,11 @@
+/*
+ * Simulated WiFi.h: keeps the host one from pulling extras/host/WiFiClient.h
+ */
+
+#ifndef FTP_SIM_WIFI_H
+#define FTP_SIM_WIFI_H
+
+#include "WiFiClient.h"
+#include "WiFiServer.h"
+
+#endif // FTP_SIM_WIFI_H
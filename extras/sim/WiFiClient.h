@@ -0,0 +1,79 @@
+/*
+ * Simulated WiFiClient
+ *
+ * Same API as extras/host/WiFiClient.h, found first on the include path
+ * of the simulator. Connections are in-memory pipes of SimNet, delayed,
+ * paced and lost on its virtual clock; copies of a WiFiClient share the
+ * same connection, as on the device.
+ *
+ * The end accepted by a WiFiServer is the device: write() blocks like on
+ * the ESP cores, the virtual clock running until the data is queued. The
+ * end opened by connectStart() belongs to a simulated client and never
+ * blocks.
+ */
+
+#ifndef FTP_SIM_WIFICLIENT_H
+#define FTP_SIM_WIFICLIENT_H
+
+#include <memory>
+
+#include "Arduino.h"
+
+// Virtual clock, given to the library as FTP_MILLIS() and FTP_MICROS().
+// millis() keeps the 32 bit range of the device and wraps around.
+unsigned long simMillis();
+unsigned long simMicros();
+
+struct SimSocket;
+
+class Client : public Stream
+{
+public:
+  virtual int connect(IPAddress ip, uint16_t port) = 0;
+  virtual int read(uint8_t *buf, size_t size) = 0;
+  virtual void stop() = 0;
+  virtual uint8_t connected() = 0;
+  virtual operator bool() = 0;
+  using Stream::read;
+  using Print::write;
+};
+
+class WiFiClient : public Client
+{
+public:
+  WiFiClient() {}
+  explicit WiFiClient(int fd); // no descriptor in the simulation, fd is closed
+  WiFiClient(const std::shared_ptr<SimSocket> &sock, uint8_t side) : sock_(sock), side_(side) {}
+
+  int connect(IPAddress ip, uint16_t port) override;
+  size_t write(const uint8_t *buf, size_t size) override;
+  int availableForWrite() override;
+  int available() override;
+  int read() override;
+  int read(uint8_t *buf, size_t size) override;
+  size_t readBytes(char *buf, size_t size) { return read((uint8_t *)buf, size); }
+  int peek() override;
+  void flush() override {}
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override;
+  void setNoDelay(bool) {}
+  void setTimeout(uint32_t ms) { timeout_ = ms; }
+
+  IPAddress remoteIP();
+  uint16_t remotePort();
+  IPAddress localIP();
+  uint16_t localPort();
+
+  // Simulation only: open a connection from a client address without
+  // waiting, connecting() is true until it is established or refused
+  void connectStart(IPAddress from, IPAddress ip, uint16_t port);
+  bool connecting();
+
+private:
+  std::shared_ptr<SimSocket> sock_;
+  uint8_t side_ = 0; // 0 accepted by a WiFiServer, 1 opened by connect
+  uint32_t timeout_ = 5000;
+};
+
+#endif // FTP_SIM_WIFICLIENT_H
@@ -0,0 +1,35 @@
+/*
+ * Simulated WiFiServer
+ *
+ * Same API as extras/host/WiFiServer.h, found first on the include path
+ * of the simulator. It accepts the connections of SimNet.
+ */
+
+#ifndef FTP_SIM_WIFISERVER_H
+#define FTP_SIM_WIFISERVER_H
+
+#include "WiFiClient.h"
+
+class WiFiServer
+{
+public:
+  explicit WiFiServer(uint16_t port) : port_(port) {}
+  void begin();
+  void begin(uint16_t port)
+  {
+    port_ = port;
+    begin();
+  }
+  void stop();
+  bool hasClient();
+  WiFiClient accept();
+  WiFiClient available() { return accept(); }
+  uint16_t port() const { return port_; }
+  void setNoDelay(bool) {}
+
+private:
+  uint16_t port_;
+  bool listening_ = false;
+};
+
+#endif // FTP_SIM_WIFISERVER_H
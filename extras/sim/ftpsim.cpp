@@ -0,0 +1,577 @@
+/*
+ * FTP simulator
+ *
+ * Runs the library, unchanged, against simulated clients replaying an
+ * extras/ftpload script over SimNet. Everything happens on a virtual
+ * clock: timeouts, pacing and throughput over a slow or lossy link are
+ * observed faster than real time, and a seed reproduces a run exactly.
+ *
+ *   usage: ftpsim [-c clients] [-i iterations] [-r ramp_ms] [-t timeout_ms]
+ *                 [-l latency_ms] [-b bandwidth_kB/s] [-p loss_%] [-w window]
+ *                 [-k ns_per_byte] [-u loop_us] [-n servers] [-s seed]
+ *                 [-d max_s] [-z] script root_dir [user] [password]
+ *
+ * -u is the time a call to handleFTP() takes on the device. An idle device
+ * is called again as soon as something arrives, 1 ms later at the latest,
+ * so that its timers are seen. -k is the time the device spends on each
+ * byte read from or written to a socket. -w is its TCP window and send
+ * buffer. -z starts the clock 30 s before millis() wraps around.
+ *
+ * Only the passive mode is simulated: the clients don't accept the
+ * connections of PORT and EPRT. Latencies and throughputs are virtual.
+ */
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <unistd.h>
+
+#include "FtpServer.h"
+#include "SimNet.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define MAX_SERVERS 8
+
+struct Options
+{
+  int clients = 1;
+  int iterations = 1;
+  int rampMs = 0;
+  int timeoutMs = 10000;
+  int servers = 1;
+  uint32_t loopUs = 100;
+  uint32_t seed = 1;
+  uint32_t maxSeconds = 3600;
+  bool nearWrap = false;
+  SimLink link;
+};
+
+struct Stats
+{
+  std::map<std::string, std::vector<double>> latency; // ms, per verb
+  std::map<std::string, uint32_t> failures;           // "VERB code" -> count
+  uint64_t bytesDown = 0, bytesUp = 0;
+  double dataSeconds = 0;
+  uint32_t sessions = 0, sessionsFailed = 0;
+};
+
+FtpServer ftpSrv[MAX_SERVERS];
+
+// One client running its sessions one after the other. step() does what
+// can be done at the current time, without waiting.
+class SimClient
+{
+public:
+  SimClient(const Options &opt, const std::vector<std::string> &script, int id, Stats &st)
+      : opt_(opt), script_(script), id_(id), st_(st), left_(opt.iterations),
+        ip_(10, 0, 1 + id / 250, 1 + id % 250)
+  {
+    wake_ = SimNet::now() + (uint64_t)id * opt.rampMs * 1000;
+  }
+
+  bool done() const { return phase_ == finished; }
+  uint64_t wakeAt() const { return phase_ == starting || phase_ == sleeping ? wake_ : UINT64_MAX; }
+
+  bool step()
+  {
+    uint64_t now = SimNet::now();
+    switch (phase_)
+    {
+    case starting:
+      if (now < wake_)
+        return false;
+      pc_ = 0;
+      verb_ = "CONNECT";
+      isData_ = false;
+      t0_ = progress_ = now;
+      ctrl_.connectStart(ip_, SimNet::deviceIp, FTP_CTRL_PORT);
+      phase_ = connecting;
+      return true;
+
+    case sleeping:
+      if (now < wake_)
+        return false;
+      next();
+      return true;
+
+    case connecting:
+      if (ctrl_.connecting())
+        return false;
+      if (!ctrl_.connected())
+      {
+        st_.failures["CONNECT refused"]++;
+        endSession(false);
+      }
+      else
+        phase_ = replying;
+      return true;
+
+    case dataConnecting:
+      if (data_.connecting())
+        return timedOut();
+      if (!data_.connected())
+      {
+        st_.failures[verb_ + " data-connect"]++;
+        endSession(false);
+        return true;
+      }
+      send(line_);
+      phase_ = replying;
+      return true;
+
+    case replying:
+    {
+      int code = readReply();
+      if (code == 0)
+        return timedOut();
+      if (verb_ == "CONNECT")
+      {
+        if (code != 220)
+        {
+          fail(code);
+          endSession(false);
+        }
+        else
+        {
+          st_.latency[verb_].push_back((now - t0_) / 1000.0);
+          next();
+        }
+      }
+      else if (isData_ && code > 0 && code < 300)
+      {
+        // data flows after the 150, or the 226 of a short listing came first
+        finalCode_ = code >= 200 ? code : 0;
+        dataDone_ = false;
+        d0_ = now;
+        phase_ = transferring;
+      }
+      else
+        finish(code);
+      return true;
+    }
+
+    case transferring:
+      return transfer(now);
+
+    case finished:
+      break;
+    }
+    return false;
+  }
+
+private:
+  enum Phase
+  {
+    starting,
+    sleeping,
+    connecting,
+    dataConnecting,
+    replying,
+    transferring,
+    finished
+  };
+
+  std::string expand(const std::string &s)
+  {
+    std::string r = s;
+    size_t p;
+    while ((p = r.find("$ID")) != std::string::npos)
+      r.replace(p, 3, std::to_string(id_));
+    return r;
+  }
+
+  void fail(int code)
+  {
+    st_.failures[verb_ + " " + (code > 0 ? std::to_string(code) : std::string("timeout"))]++;
+  }
+
+  bool timedOut()
+  {
+    if (SimNet::now() - progress_ <= (uint64_t)opt_.timeoutMs * 1000)
+      return false;
+    fail(-1);
+    endSession(false);
+    return true;
+  }
+
+  void send(const std::string &line)
+  {
+    std::string l = line + "\r\n";
+    text_.clear();
+    ctrl_.write((const uint8_t *)l.data(), l.size());
+  }
+
+  // Code of a complete (possibly multi-line) reply, 0 if it is not there
+  // yet, -1 if the connection was closed before
+  int readReply()
+  {
+    uint8_t tmp[512];
+    int n;
+    while ((n = ctrl_.read(tmp, sizeof(tmp))) > 0)
+    {
+      in_.append((const char *)tmp, n);
+      progress_ = SimNet::now();
+    }
+    size_t nl;
+    while ((nl = in_.find('\n')) != std::string::npos)
+    {
+      std::string line = in_.substr(0, nl);
+      if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+      in_.erase(0, nl + 1);
+      if (line.size() < 3 || !isdigit(line[0]))
+        continue;
+      if (code_ < 0)
+        code_ = atoi(line.c_str());
+      text_ += line + "\n";
+      if (atoi(line.c_str()) == code_ && (line.size() == 3 || line[3] == ' '))
+      {
+        int code = code_;
+        code_ = -1;
+        return code;
+      }
+    }
+    return ctrl_.connected() ? 0 : -1;
+  }
+
+  // Next command of the script
+  void next()
+  {
+    uint64_t now = SimNet::now();
+    if (pc_ >= script_.size())
+    {
+      endSession(true);
+      return;
+    }
+    line_ = expand(script_[pc_++]);
+    verb_ = line_.substr(0, line_.find(' '));
+    if (verb_ == "SLEEP")
+    {
+      wake_ = now + (uint64_t)atoi(line_.c_str() + 6) * 1000;
+      phase_ = sleeping;
+      return;
+    }
+    isData_ = verb_ == "LIST" || verb_ == "NLST" || verb_ == "MLSD" ||
+              verb_ == "RETR" || verb_ == "STOR";
+    upload_ = sent_ = 0;
+    if (verb_ == "STOR")
+    {
+      // "STOR path size": the size is ours, not the server's
+      size_t sp = line_.rfind(' ');
+      if (sp != std::string::npos && sp > 5)
+      {
+        upload_ = strtoull(line_.c_str() + sp + 1, nullptr, 10);
+        line_.erase(sp);
+      }
+    }
+    t0_ = progress_ = now;
+    if (isData_)
+    {
+      data_.connectStart(ip_, pasvIp_, pasvPort_);
+      phase_ = dataConnecting;
+    }
+    else
+    {
+      send(line_);
+      phase_ = replying;
+    }
+  }
+
+  bool transfer(uint64_t now)
+  {
+    bool moved = false;
+    if (!dataDone_)
+    {
+      if (verb_ == "STOR")
+      {
+        uint8_t tmp[8192];
+        memset(tmp, 'a' + id_ % 26, sizeof(tmp));
+        size_t n = data_.write(tmp, std::min<uint64_t>(sizeof(tmp), upload_ - sent_));
+        sent_ += n;
+        moved = n > 0;
+        if (sent_ >= upload_ || !data_.connected())
+          dataDone_ = true;
+      }
+      else
+      {
+        uint8_t tmp[8192];
+        int n;
+        while ((n = data_.read(tmp, sizeof(tmp))) > 0)
+        {
+          st_.bytesDown += n;
+          moved = true;
+        }
+        dataDone_ = !data_.connected();
+      }
+      if (dataDone_)
+      {
+        st_.bytesUp += sent_;
+        data_.stop();
+        st_.dataSeconds += (now - d0_) / 1e6;
+      }
+    }
+    if (finalCode_ == 0)
+    {
+      int code = readReply();
+      if (code != 0)
+        finalCode_ = code;
+    }
+    if (moved)
+      progress_ = now;
+    if (dataDone_ && finalCode_ != 0)
+    {
+      finish(finalCode_);
+      return true;
+    }
+    return moved || timedOut();
+  }
+
+  void finish(int code)
+  {
+    data_.stop();
+    if (code < 0 || code >= 400)
+    {
+      fail(code);
+      if (code < 0)
+      {
+        endSession(false);
+        return;
+      }
+    }
+    else
+    {
+      st_.latency[verb_].push_back((SimNet::now() - t0_) / 1000.0);
+      if (verb_ == "PASV")
+        parsePasv();
+    }
+    if (verb_ == "QUIT")
+      endSession(true);
+    else
+      next();
+  }
+
+  void parsePasv()
+  {
+    size_t p = text_.find('(');
+    unsigned h[4], ph, pl;
+    if (p != std::string::npos &&
+        sscanf(text_.c_str() + p + 1, "%u,%u,%u,%u,%u,%u", &h[0], &h[1], &h[2], &h[3], &ph, &pl) == 6)
+    {
+      pasvIp_ = IPAddress(h[0], h[1], h[2], h[3]);
+      if ((uint32_t)pasvIp_ == 0)
+        pasvIp_ = SimNet::deviceIp;
+      pasvPort_ = ph * 256 + pl;
+    }
+  }
+
+  void endSession(bool ok)
+  {
+    ctrl_.stop();
+    data_.stop();
+    in_.clear();
+    code_ = -1;
+    st_.sessions++;
+    if (!ok)
+      st_.sessionsFailed++;
+    wake_ = SimNet::now();
+    phase_ = --left_ > 0 ? starting : finished;
+  }
+
+  const Options &opt_;
+  const std::vector<std::string> &script_;
+  int id_;
+  Stats &st_;
+  int left_; // sessions still to run
+  IPAddress ip_;
+  Phase phase_ = starting;
+  uint64_t wake_ = 0;
+  size_t pc_ = 0;
+  std::string line_, verb_;
+  bool isData_ = false;
+  uint64_t t0_ = 0;       // command sent
+  uint64_t progress_ = 0; // last byte moved, for the timeout
+  uint64_t d0_ = 0;       // data started
+  WiFiClient ctrl_, data_;
+  std::string in_, text_;
+  int code_ = -1; // code of the reply being read
+  int finalCode_ = 0;
+  bool dataDone_ = false;
+  uint64_t upload_ = 0, sent_ = 0;
+  IPAddress pasvIp_;
+  uint16_t pasvPort_ = 0;
+};
+
+static double percentile(std::vector<double> &v, double p)
+{
+  if (v.empty())
+    return 0;
+  size_t i = std::min(v.size() - 1, (size_t)(p / 100.0 * v.size()));
+  return v[i];
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-c clients] [-i iterations] [-r ramp_ms] [-t timeout_ms] "
+                  "[-l latency_ms] [-b bandwidth_kB/s] [-p loss_%%] [-w window] [-k ns_per_byte] "
+                  "[-u loop_us] [-n servers] [-s seed] [-d max_s] [-z] script root_dir [user] [password]\n",
+          prog);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  Options opt;
+  int c;
+  while ((c = getopt(argc, argv, "c:i:r:t:l:b:p:w:k:u:n:s:d:z")) != -1)
+  {
+    switch (c)
+    {
+    case 'c':
+      opt.clients = std::max(1, atoi(optarg));
+      break;
+    case 'i':
+      opt.iterations = std::max(1, atoi(optarg));
+      break;
+    case 'r':
+      opt.rampMs = atoi(optarg);
+      break;
+    case 't':
+      opt.timeoutMs = atoi(optarg);
+      break;
+    case 'l':
+      opt.link.latencyUs = atof(optarg) * 1000;
+      break;
+    case 'b':
+      opt.link.bytesPerSec = std::max(1.0, atof(optarg) * 1024);
+      break;
+    case 'p':
+      opt.link.loss = atof(optarg) / 100;
+      break;
+    case 'w':
+      opt.link.deviceWindow = std::max<int>(opt.link.mss, atoi(optarg));
+      break;
+    case 'k':
+      opt.link.deviceNsPerByte = atoi(optarg);
+      break;
+    case 'u':
+      opt.loopUs = std::max(1, atoi(optarg));
+      break;
+    case 'n':
+      opt.servers = atoi(optarg);
+      break;
+    case 's':
+      opt.seed = strtoul(optarg, NULL, 10);
+      break;
+    case 'd':
+      opt.maxSeconds = atoi(optarg);
+      break;
+    case 'z':
+      opt.nearWrap = true;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (argc - optind < 2 || opt.servers < 1 || opt.servers > MAX_SERVERS)
+    usage(argv[0]);
+
+  std::vector<std::string> script;
+  std::ifstream in(argv[optind]);
+  if (!in)
+  {
+    fprintf(stderr, "can't read %s\n", argv[optind]);
+    return 1;
+  }
+  for (std::string line; std::getline(in, line);)
+  {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if (!line.empty() && line[0] != '#')
+      script.push_back(line);
+  }
+  if (!LittleFS.begin(argv[optind + 1]))
+  {
+    fprintf(stderr, "%s is not a directory\n", argv[optind + 1]);
+    return 1;
+  }
+
+  uint64_t start = opt.nearWrap ? (0x100000000ULL - 30000) * 1000 : 0;
+  SimNet::begin(opt.link, opt.seed, start);
+  for (int i = 0; i < opt.servers; i++)
+    ftpSrv[i].begin(argc - optind > 2 ? argv[optind + 2] : "esp", argc - optind > 3 ? argv[optind + 3] : "esp");
+
+  Stats total;
+  std::vector<std::unique_ptr<SimClient>> clients;
+  for (int i = 0; i < opt.clients; i++)
+    clients.emplace_back(new SimClient(opt, script, i, total));
+
+  auto wall = std::chrono::steady_clock::now();
+  uint64_t end = start + (uint64_t)opt.maxSeconds * 1000000;
+  uint64_t calls = 0;
+  bool finished = false;
+  while (!finished && SimNet::now() < end)
+  {
+    bool busy = false;
+    for (int i = 0; i < opt.servers; i++)
+      busy |= ftpSrv[i].handleFTP();
+    calls++;
+
+    bool active = false;
+    uint64_t wake = UINT64_MAX;
+    finished = true;
+    for (auto &cl : clients)
+    {
+      active |= cl->step();
+      if (!cl->done())
+      {
+        finished = false;
+        wake = std::min(wake, cl->wakeAt());
+      }
+    }
+    // a call takes loopUs, an idle device waits for the next thing due
+    uint64_t now = SimNet::now();
+    uint64_t next = now + opt.loopUs;
+    if (!busy && !active)
+      next = std::max(next, std::min({SimNet::nextEvent(), wake, now + 1000}));
+    SimNet::advanceTo(next);
+  }
+  double elapsed = (SimNet::now() - start) / 1e6;
+  double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall).count();
+
+  printf("%d clients x %d iterations, seed %u, %.1f ms latency, %u kB/s, %.2f%% loss\n",
+         opt.clients, opt.iterations, opt.seed, opt.link.latencyUs / 1000.0,
+         opt.link.bytesPerSec / 1024, opt.link.loss * 100);
+  printf("%.3f s virtual, %llu calls to handleFTP()%s\n", elapsed, (unsigned long long)calls,
+         finished ? "" : ", stopped before the end of the sessions");
+  printf("sessions: %u, failed: %u\n\n", total.sessions, total.sessionsFailed);
+  printf("%-8s %8s %10s %10s %10s %10s\n", "command", "count", "p50 ms", "p90 ms", "p99 ms", "max ms");
+  for (auto &l : total.latency)
+  {
+    std::vector<double> &v = l.second;
+    std::sort(v.begin(), v.end());
+    printf("%-8s %8zu %10.2f %10.2f %10.2f %10.2f\n", l.first.c_str(), v.size(),
+           percentile(v, 50), percentile(v, 90), percentile(v, 99), v.empty() ? 0 : v.back());
+  }
+  if (elapsed > 0)
+    printf("\nthroughput: %.1f kB/s down, %.1f kB/s up (%llu / %llu bytes)\n",
+           total.bytesDown / 1024.0 / elapsed, total.bytesUp / 1024.0 / elapsed,
+           (unsigned long long)total.bytesDown, (unsigned long long)total.bytesUp);
+  if (total.dataSeconds > 0)
+    printf("per data connection: %.1f kB/s\n",
+           (total.bytesDown + total.bytesUp) / 1024.0 / total.dataSeconds);
+  if (!total.failures.empty())
+  {
+    printf("\nfailures:\n");
+    for (auto &f : total.failures)
+      printf("  %-24s %u\n", f.first.c_str(), f.second);
+  }
+  // on stderr, so that the report of a seed is always the same
+  fprintf(stderr, "%.2f s real, %.0fx real time\n", wallSeconds, wallSeconds > 0 ? elapsed / wallSeconds : 0);
+  return total.sessionsFailed || !finished ? 2 : 0;
+}
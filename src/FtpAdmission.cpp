@@ -0,0 +1,99 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Admission of new connections and login backoff
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpServer.h"
+
+FtpAdmission::FtpAdmission()
+{
+  memset(entries, 0, sizeof(entries));
+  servers = sessions = unauthenticated = 0;
+  refused = 0;
+}
+
+FtpAdmission::Entry *FtpAdmission::find(uint32_t ip, boolean create)
+{
+  Entry *oldest = &entries[0];
+  uint32_t now = FTP_MILLIS();
+  for (uint8_t i = 0; i < FTP_ADMIT_ENTRIES; i++)
+  {
+    Entry *e = &entries[i];
+    if (e->ip != 0 && now - e->lastFailure > FTP_BACKOFF_FORGET_MS)
+      e->ip = 0;
+    if (e->ip == ip && ip != 0)
+      return e;
+    if (oldest->ip != 0 && (e->ip == 0 || now - e->lastFailure > now - oldest->lastFailure))
+      oldest = e;
+  }
+  if (!create)
+    return NULL;
+  memset(oldest, 0, sizeof(*oldest));
+  oldest->ip = ip;
+  return oldest;
+}
+
+const char *FtpAdmission::check(IPAddress ip)
+{
+  const char *refusal = NULL;
+  Entry *e = find((uint32_t)ip, false);
+  if (e != NULL && FTP_MILLIS() - e->lastFailure < e->backoff)
+    refusal = "421 Too many failed logins, try again later";
+  else if (unauthenticated >= (FTP_MAX_UNAUTH > 0 ? FTP_MAX_UNAUTH : servers))
+    refusal = "421 Too many connections, try again later";
+  else if (full())
+    refusal = "421 Too many users, try again later";
+  if (refusal != NULL)
+  {
+    refused++;
+    FTPdebug("connexion de %s refusée\n", ip.toString().c_str());
+  }
+  return refusal;
+}
+
+void FtpAdmission::opened()
+{
+  sessions++;
+  unauthenticated++;
+}
+
+void FtpAdmission::loggedIn(IPAddress ip)
+{
+  if (unauthenticated > 0)
+    unauthenticated--;
+  Entry *e = find((uint32_t)ip, false);
+  if (e != NULL)
+    e->ip = 0;
+}
+
+void FtpAdmission::closed(IPAddress ip, boolean loggedIn)
+{
+  if (sessions > 0)
+    sessions--;
+  if (loggedIn)
+    return;
+  if (unauthenticated > 0)
+    unauthenticated--;
+  Entry *e = find((uint32_t)ip, true);
+  if (e->failures < 31)
+    e->failures++;
+  e->lastFailure = FTP_MILLIS();
+  e->backoff = (uint32_t)FTP_BACKOFF_MS << (e->failures - 1);
+  if (e->backoff > FTP_BACKOFF_MAX_MS || e->failures > 20)
+    e->backoff = FTP_BACKOFF_MAX_MS;
+  FTPdebug("%s sans login : %u échecs, attente %lu ms\n", ip.toString().c_str(), e->failures,
+           (unsigned long)e->backoff);
+}
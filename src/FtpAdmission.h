@@ -0,0 +1,85 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Admission of new connections and login backoff
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FTP_ADMISSION_H
+#define FTP_ADMISSION_H
+
+// Shared by all the FtpServer of a sketch. A new connection is refused
+// with a single "421" line, before the banner, when:
+//  - its address is backing off after sessions that ended without a
+//    login (wrong user or password, timeout, scanners that connect and
+//    leave): 1 s after the first, doubled after each next one, up to
+//    FTP_BACKOFF_MAX_MS. A successful login forgets the address.
+//  - FTP_MAX_UNAUTH sessions are already waiting for their login. 0, the
+//    default, allows as many as there are servers, so that a client may
+//    open them all at once. Lower it to keep servers free for a logged in
+//    user while others are still typing their password.
+//  - every server already has a session: a session in progress is never
+//    replaced by a newcomer
+// The addresses are kept in a table of FTP_ADMIT_ENTRIES entries, the
+// least recently seen one is reused when it is full.
+//
+// Include through FtpServer.h.
+
+#ifndef FTP_ADMIT_ENTRIES
+#define FTP_ADMIT_ENTRIES 16 // client addresses remembered for the backoff
+#endif
+#ifndef FTP_MAX_UNAUTH
+#define FTP_MAX_UNAUTH 0 // sessions not logged in yet, all servers together (0: one per server)
+#endif
+#ifndef FTP_BACKOFF_MS
+#define FTP_BACKOFF_MS 1000 // backoff after the first session without login
+#endif
+#ifndef FTP_BACKOFF_MAX_MS
+#define FTP_BACKOFF_MAX_MS (10 * 60 * 1000UL) // longest backoff
+#endif
+#ifndef FTP_BACKOFF_FORGET_MS
+#define FTP_BACKOFF_FORGET_MS (30 * 60 * 1000UL) // failures older than this are forgotten
+#endif
+
+class FtpAdmission
+{
+public:
+  FtpAdmission();
+
+  // Reply refusing a connection from ip, or NULL if it is admitted
+  const char *check(IPAddress ip);
+  boolean full() { return sessions >= servers; }
+
+  uint8_t addServer() { return servers++; } // index of the new server
+  void opened();                              // admitted session, not logged in yet
+  void loggedIn(IPAddress ip);
+  void closed(IPAddress ip, boolean loggedIn);
+
+  uint32_t refused; // connections refused since boot
+
+private:
+  struct Entry
+  {
+    uint32_t ip; // 0 when the slot is free
+    uint8_t failures;
+    uint32_t lastFailure; // FTP_MILLIS()
+    uint32_t backoff;     // ms after lastFailure
+  };
+  Entry *find(uint32_t ip, boolean create);
+
+  Entry entries[FTP_ADMIT_ENTRIES];
+  uint8_t servers, sessions, unauthenticated;
+};
+
+#endif // FTP_ADMISSION_H
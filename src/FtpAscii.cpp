@@ -0,0 +1,123 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Line ends of TYPE A transfers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpServer.h"
+
+// Native word: 4 bytes on the ESP, 8 on a 64 bit host
+static const size_t ONES = (size_t)-1 / 0xff; // 0x01 in each byte
+static const size_t HIGHS = ONES << 7;        // 0x80 in each byte
+
+const uint8_t *FtpAscii::find(const uint8_t *p, const uint8_t *end, uint8_t c)
+{
+  // byte by byte up to a word boundary, the ESP can't load a word elsewhere
+  while (p < end && ((uintptr_t)p & (sizeof(size_t) - 1)) != 0)
+  {
+    if (*p == c)
+      return p;
+    p++;
+  }
+  // then a word at a time: a byte equal to c is 0 in v, and (v - ONES) & ~v
+  // has the high bit of the first zero byte set
+  size_t pattern = ONES * c;
+  while ((size_t)(end - p) >= sizeof(size_t))
+  {
+    size_t v;
+    memcpy(&v, __builtin_assume_aligned(p, sizeof(size_t)), sizeof(size_t));
+    v ^= pattern;
+    if (((v - ONES) & ~v & HIGHS) != 0)
+      break;
+    p += sizeof(size_t);
+  }
+  while (p < end && *p != c)
+    p++;
+  return p;
+}
+
+size_t FtpAscii::toCrlf(uint8_t *out, const uint8_t *in, size_t len, boolean &lastCR)
+{
+  // out never catches up with the bytes of in not read yet: it is ahead
+  // by the number of CRs added, at most len
+  const uint8_t *end = in + len;
+  uint8_t *o = out;
+  while (in < end)
+  {
+    const uint8_t *lf = find(in, end, '\n');
+    size_t n = lf - in;
+    if (n > 0)
+    {
+      lastCR = lf[-1] == '\r';
+      memmove(o, in, n);
+      o += n;
+    }
+    if (lf == end)
+      break;
+    if (!lastCR)
+      *o++ = '\r';
+    *o++ = '\n';
+    lastCR = false;
+    in = lf + 1;
+  }
+  return o - out;
+}
+
+const uint8_t *FtpAscii::fitCrlf(const uint8_t *in, size_t len, boolean lastCR, size_t room, size_t &crs)
+{
+  const uint8_t *p = in, *end = in + len;
+  crs = 0;
+  while ((p = find(p, end, '\n')) < end)
+  {
+    if (!(p > in ? p[-1] == '\r' : lastCR))
+    {
+      if (crs == room)
+        return p; // the CR of this LF doesn't fit
+      crs++;
+    }
+    p++;
+  }
+  return end;
+}
+
+size_t FtpAscii::fromCrlf(uint8_t *out, const uint8_t *in, size_t len, boolean &heldCR)
+{
+  const uint8_t *end = in + len;
+  uint8_t *o = out;
+  if (heldCR && len > 0)
+  {
+    // the CR that ended the previous chunk
+    if (*in != '\n')
+      *o++ = '\r';
+    heldCR = false;
+  }
+  while (in < end)
+  {
+    const uint8_t *cr = find(in, end, '\r');
+    memmove(o, in, cr - in);
+    o += cr - in;
+    if (cr == end)
+      break;
+    if (cr + 1 == end)
+    {
+      heldCR = true;
+      break;
+    }
+    if (cr[1] != '\n')
+      *o++ = '\r';
+    in = cr + 1;
+  }
+  return o - out;
+}
@@ -0,0 +1,56 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Line ends of TYPE A transfers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FTP_ASCII_H
+#define FTP_ASCII_H
+
+// Files keep LF line ends, TYPE A sends CRLF on the wire (RFC 959). The
+// bytes between two line ends are looked at a word at a time and moved
+// with memmove, only the line ends themselves are handled one by one.
+// A chunk may end between a CR and its LF, the flag given by the caller
+// keeps what is needed for the next chunk.
+//
+// Include through FtpServer.h.
+
+class FtpAscii
+{
+public:
+  // First c in [p, end), or end
+  static const uint8_t *find(const uint8_t *p, const uint8_t *end, uint8_t c);
+
+  // RETR: a CR before each LF that has none. out has room for len bytes
+  // and the CRs, and may hold in, as long as in starts at least as many
+  // bytes after out as there are CRs to add (fitCrlf() counts them).
+  // lastCR tells whether the byte before in was a CR.
+  //
+  //  return: bytes in out
+  static size_t toCrlf(uint8_t *out, const uint8_t *in, size_t len, boolean &lastCR);
+
+  // RETR: end of the longest part of in (len bytes) to which toCrlf()
+  // adds at most room CRs. crs receives the number it adds.
+  static const uint8_t *fitCrlf(const uint8_t *in, size_t len, boolean lastCR, size_t room, size_t &crs);
+
+  // STOR: the CR of each CRLF removed. out may be in or in - 1. A CR at
+  // the end of in is not written but kept in heldCR, for the next chunk
+  // or for the end of the transfer.
+  //
+  //  return: bytes in out
+  static size_t fromCrlf(uint8_t *out, const uint8_t *in, size_t len, boolean &heldCR);
+};
+
+#endif // FTP_ASCII_H
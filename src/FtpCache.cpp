@@ -0,0 +1,156 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * In-RAM LRU cache of small files served by RETR
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpServer.h"
+
+static uint8_t *cacheAlloc(uint32_t size)
+{
+#if defined(ESP32) && defined(BOARD_HAS_PSRAM)
+  if (psramFound())
+    return (uint8_t *)ps_malloc(size);
+#endif
+  return (uint8_t *)malloc(size);
+}
+
+FtpCache::FtpCache()
+{
+  memset(entries, 0, sizeof(entries));
+  budget = FTP_CACHE_SIZE;
+  maxFileSize = FTP_CACHE_MAX_FILE;
+  used = 0;
+  useCounter = 0;
+  hits = misses = 0;
+}
+
+void FtpCache::setSize(uint32_t bytes)
+{
+  budget = bytes;
+  while (used > budget && evictLru())
+    ;
+}
+
+FtpCacheEntry *FtpCache::lookup(const char *path)
+{
+  if (budget == 0)
+    return NULL;
+  for (uint8_t i = 0; i < FTP_CACHE_ENTRIES; i++)
+  {
+    FtpCacheEntry *e = &entries[i];
+    if (e->path != NULL && e->ready && !e->stale && !strcmp(e->path, path))
+    {
+      e->users++;
+      e->lastUse = ++useCounter;
+      hits++;
+      return e;
+    }
+  }
+  misses++;
+  return NULL;
+}
+
+FtpCacheEntry *FtpCache::reserve(const char *path, uint32_t size)
+{
+  if (budget == 0 || size > maxFileSize || size > budget)
+    return NULL;
+  for (uint8_t i = 0; i < FTP_CACHE_ENTRIES; i++)
+    if (entries[i].path != NULL && !entries[i].stale && !strcmp(entries[i].path, path))
+      return NULL; // already cached or being filled by another transfer
+  while (used + size > budget)
+    if (!evictLru())
+      return NULL;
+
+  FtpCacheEntry *e = NULL;
+  for (uint8_t i = 0; i < FTP_CACHE_ENTRIES && e == NULL; i++)
+    if (entries[i].path == NULL)
+      e = &entries[i];
+  if (e == NULL)
+  {
+    if (!evictLru())
+      return NULL;
+    return reserve(path, size);
+  }
+  e->path = strdup(path);
+  e->data = cacheAlloc(size > 0 ? size : 1);
+  if (e->path == NULL || e->data == NULL)
+  {
+    free(e->path);
+    free(e->data);
+    e->path = NULL;
+    e->data = NULL;
+    return NULL;
+  }
+  e->size = size;
+  e->users = 1;
+  e->ready = false;
+  e->stale = false;
+  e->lastUse = ++useCounter;
+  used += size;
+  return e;
+}
+
+void FtpCache::commit(FtpCacheEntry *entry)
+{
+  entry->ready = true;
+  release(entry);
+}
+
+void FtpCache::release(FtpCacheEntry *entry)
+{
+  if (entry->users > 0)
+    entry->users--;
+  if (entry->users == 0 && (entry->stale || !entry->ready))
+    drop(entry);
+}
+
+void FtpCache::invalidate(const char *path)
+{
+  size_t n = strlen(path);
+  for (uint8_t i = 0; i < FTP_CACHE_ENTRIES; i++)
+  {
+    FtpCacheEntry *e = &entries[i];
+    if (e->path == NULL || strncmp(e->path, path, n) || (e->path[n] != 0 && e->path[n] != '/'))
+      continue;
+    FTPdebug("cache : %s invalidé\n", e->path);
+    if (e->users > 0)
+      e->stale = true;
+    else
+      drop(e);
+  }
+}
+
+void FtpCache::drop(FtpCacheEntry *entry)
+{
+  free(entry->path);
+  free(entry->data);
+  used -= entry->size;
+  memset(entry, 0, sizeof(FtpCacheEntry));
+}
+
+// Drop the least recently used entry that is not in use
+boolean FtpCache::evictLru()
+{
+  FtpCacheEntry *lru = NULL;
+  for (uint8_t i = 0; i < FTP_CACHE_ENTRIES; i++)
+    if (entries[i].path != NULL && entries[i].users == 0 &&
+        (lru == NULL || entries[i].lastUse < lru->lastUse))
+      lru = &entries[i];
+  if (lru == NULL)
+    return false;
+  drop(lru);
+  return true;
+}
@@ -0,0 +1,82 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * In-RAM LRU cache of small files served by RETR
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FTP_CACHE_H
+#define FTP_CACHE_H
+
+// A file of at most maxFileSize bytes is copied to the cache while a RETR
+// reads it, the next RETR of the same path is served from RAM. The least
+// recently used files are evicted to stay within the byte budget. The
+// content is kept in PSRAM on ESP32 boards that have it.
+//
+// Entries are dropped on STOR, DELE and RNTO of their path (or of a parent
+// directory), and again once a STOR or a SITE CPY has written the file,
+// since a RETR may have cached the old content meanwhile; a sketch that
+// writes files itself must call invalidate().
+// An entry in use by a transfer is pinned and only freed when released.
+//
+// Include through FtpServer.h.
+
+#ifndef FTP_CACHE_SIZE
+#define FTP_CACHE_SIZE 0 // byte budget of the cache, 0 to disable it
+#endif
+#ifndef FTP_CACHE_MAX_FILE
+#define FTP_CACHE_MAX_FILE 8192 // larger files are never cached
+#endif
+#ifndef FTP_CACHE_ENTRIES
+#define FTP_CACHE_ENTRIES 8 // max number of cached files
+#endif
+
+struct FtpCacheEntry
+{
+  char *path; // NULL when the slot is free
+  uint8_t *data;
+  uint32_t size;
+  uint32_t lastUse;
+  uint8_t users;  // transfers reading or filling this entry
+  boolean ready;  // completely filled
+  boolean stale;  // invalidated while in use, freed on release
+};
+
+class FtpCache
+{
+public:
+  FtpCache();
+
+  void setSize(uint32_t bytes); // 0 disables the cache and frees it
+  uint32_t getSize() { return budget; }
+  void setMaxFileSize(uint32_t bytes) { maxFileSize = bytes; }
+  uint32_t getUsed() { return used; }
+  uint32_t hits, misses;
+
+  FtpCacheEntry *lookup(const char *path);                 // ready entry, pinned, or NULL
+  FtpCacheEntry *reserve(const char *path, uint32_t size); // empty entry to fill, pinned, or NULL
+  void commit(FtpCacheEntry *entry);                       // entry filled, unpin it
+  void release(FtpCacheEntry *entry);                      // unpin, drop it if not filled
+  void invalidate(const char *path);                       // path and everything below it
+
+private:
+  void drop(FtpCacheEntry *entry);
+  boolean evictLru();
+
+  FtpCacheEntry entries[FTP_CACHE_ENTRIES];
+  uint32_t budget, used, maxFileSize;
+  uint32_t useCounter;
+};
+
+#endif // FTP_CACHE_H
@@ -0,0 +1,110 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Index of the stored files by content
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpServer.h"
+
+// "<FTP_DEDUP_DIR>/<first FTP_DEDUP_KEY hex digits of sha>"
+boolean FtpDedup::entryPath(char *entry, const uint8_t *sha)
+{
+  char hex[65];
+  FtpDigest::toHex(hex, sha, 32);
+  hex[FTP_DEDUP_KEY] = 0;
+  return snprintf(entry, FTP_CWD_SIZE, "%s/%s", FTP_DEDUP_DIR, hex) < FTP_CWD_SIZE;
+}
+
+// Next path of an entry, -1 after the last one
+int16_t FtpDedup::readLine(File &f, char *line)
+{
+  int16_t n = 0;
+  int c;
+  while ((c = f.read()) >= 0 && c != '\n')
+    if (n < FTP_CWD_SIZE - 1)
+      line[n++] = c;
+  line[n] = 0;
+  return c < 0 && n == 0 ? -1 : n;
+}
+
+void FtpDedup::record(const char *path, const FtpDigest &digest)
+{
+  char entry[FTP_CWD_SIZE], line[FTP_CWD_SIZE];
+  size_t n = strlen(FTP_DEDUP_DIR);
+  // nothing to gain on empty files, and the index doesn't index itself
+  if (digest.size == 0 || (!strncmp(path, FTP_DEDUP_DIR, n) && path[n] == '/') || !entryPath(entry, digest.sha))
+    return;
+  uint8_t paths = 0;
+  File f = FTP_FS.open(entry, "r");
+  if (f)
+  {
+    while (readLine(f, line) >= 0 && strcmp(line, path))
+      paths++;
+    boolean known = !strcmp(line, path); // line is empty after the last one
+    f.close();
+    if (known || paths >= FTP_DEDUP_PATHS)
+      return;
+  }
+  else if (!FTP_FS.exists(FTP_DEDUP_DIR))
+    FTP_FS.mkdir(FTP_DEDUP_DIR);
+  f = FTP_FS.open(entry, "a");
+  if (!f)
+    return;
+  f.print(path);
+  f.print("\n");
+  f.close();
+}
+
+boolean FtpDedup::find(char *path, const uint8_t *sha, uint32_t size)
+{
+  char entry[FTP_CWD_SIZE];
+  if (!entryPath(entry, sha))
+    return false;
+  File f = FTP_FS.open(entry, "r");
+  if (!f)
+    return false;
+  boolean found = false, current = false;
+  while (!found && readLine(f, path) > 0)
+  {
+    FtpDigest digest;
+    if (digest.load(path) && !memcmp(digest.sha, sha, 32))
+    {
+      current = true;
+      found = digest.size == size;
+    }
+  }
+  f.close();
+  if (!current)
+  {
+    // the files are gone or have changed
+    FTPdebug("entrée périmée %s\n", entry);
+    FTP_FS.remove(entry);
+  }
+  return found;
+}
+
+boolean FtpDedup::inIndex(const char *dir, const char *relName)
+{
+  // dir + "/" + relName starts with FTP_DEDUP_DIR, followed by '/' or the end
+  const char *index = FTP_DEDUP_DIR;
+  size_t d = strlen(dir);
+  if (d > 0 && dir[d - 1] == '/')
+    d--;
+  if (d >= strlen(index) || strncmp(dir, index, d) || index[d] != '/')
+    return false;
+  index += d + 1;
+  size_t n = strlen(index);
+  return !strncmp(relName, index, n) && (relName[n] == 0 || relName[n] == '/');
+}
@@ -0,0 +1,64 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Index of the stored files by content
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FTP_DEDUP_H
+#define FTP_DEDUP_H
+
+// With FTP_DEDUP, each time the digests of a file are saved (after a STOR
+// in one piece, by HASH or XCRC, and after a RETR with
+// FTP_HASH_ON_TRANSFER), its path is added to a file of FTP_DEDUP_DIR
+// named after its SHA-256, one line for each of the first
+// FTP_DEDUP_PATHS files with this content. SITE DEDUP
+// finds there a file with the content a client is about to upload, and
+// copies it instead of receiving it.
+//
+// The index is not updated when a file is deleted, renamed or changed by
+// the sketch: find() checks the digests of the files it points to, and
+// drops the entry once none of them match any more.
+//
+// The index is hidden from the listings of the directories above it.
+//
+// Include through FtpServer.h, which defines the sizes used here.
+
+#ifndef FTP_DEDUP_DIR
+#define FTP_DEDUP_DIR "/.dedup" // index of the files by content
+#endif
+#ifndef FTP_DEDUP_KEY
+#define FTP_DEDUP_KEY 24 // hex digits of the SHA-256 in the names of the index
+#endif
+#ifndef FTP_DEDUP_PATHS
+#define FTP_DEDUP_PATHS 4 // files indexed for one content
+#endif
+
+class FtpDedup
+{
+public:
+  static void record(const char *path, const FtpDigest &digest);
+
+  // path of a file of size bytes with the SHA-256 sha, in path
+  static boolean find(char *path, const uint8_t *sha, uint32_t size);
+
+  // The entry relName of a listing of dir is the index or in it
+  static boolean inIndex(const char *dir, const char *relName);
+
+private:
+  static boolean entryPath(char *entry, const uint8_t *sha);
+  static int16_t readLine(File &f, char *line);
+};
+
+#endif // FTP_DEDUP_H
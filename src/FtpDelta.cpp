@@ -0,0 +1,122 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Block signatures and delta uploads
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpServer.h"
+
+static uint32_t getBE32(const uint8_t *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+boolean FtpDeltaDecoder::begin(const char *basisPath, uint16_t blockSize)
+{
+  basis = FTP_FS.open(basisPath, "r");
+  if (!basis)
+    return false;
+  basisSize = basis.size();
+  block = blockSize;
+  have = 0;
+  op = 0;
+  remain = 0;
+  readCount = 0;
+  return true;
+}
+
+void FtpDeltaDecoder::end()
+{
+  basis.close();
+  op = 0;
+  have = 0;
+}
+
+int32_t FtpDeltaDecoder::step(FtpConnection &in, uint32_t maxRead, uint8_t *out, uint16_t size)
+{
+  readCount = 0;
+
+  // a copy goes on without the data connection
+  if (op == 'C')
+  {
+    int16_t nb = basis.read(out, remain < size ? remain : size);
+    if (nb <= 0)
+      return -1;
+    remain -= nb;
+    if (remain == 0)
+      op = 0;
+    return nb;
+  }
+
+  if (op == 'L')
+  {
+    if (maxRead > remain)
+      maxRead = remain;
+    if (maxRead > size)
+      maxRead = size;
+    int16_t nb = maxRead > 0 ? in.read(out, maxRead) : 0;
+    if (nb <= 0)
+      return 0;
+    readCount = nb;
+    remain -= nb;
+    if (remain == 0)
+      op = 0;
+    return nb;
+  }
+
+  // header of the next instruction, maybe in several pieces
+  uint8_t need = (have > 0 && header[0] == 'L') ? 5 : 9;
+  while (have < need && readCount < maxRead)
+  {
+    int c = in.read();
+    if (c < 0)
+      break;
+    readCount++;
+    header[have++] = c;
+    if (have == 1)
+    {
+      if (c != 'C' && c != 'L')
+      {
+        FTPdebug("instruction delta inconnue %02x\n", c);
+        return -1;
+      }
+      need = c == 'L' ? 5 : 9;
+    }
+  }
+  if (have < need)
+    return 0;
+  have = 0;
+  op = header[0];
+  if (op == 'L')
+  {
+    remain = getBE32(header + 1);
+    if (remain == 0)
+      op = 0;
+    return 0;
+  }
+
+  uint32_t first = getBE32(header + 1), count = getBE32(header + 5);
+  uint64_t from = (uint64_t)first * block;
+  if (from >= basisSize || count == 0)
+  {
+    FTPdebug("blocs %lu+%lu hors du fichier\n", (unsigned long)first, (unsigned long)count);
+    return -1;
+  }
+  uint64_t len = (uint64_t)count * block;
+  remain = from + len > basisSize ? basisSize - from : len;
+  if (!basis.seek(from))
+    return -1;
+  return 0;
+}
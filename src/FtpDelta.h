@@ -0,0 +1,93 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Block signatures and delta uploads
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FTP_DELTA_H
+#define FTP_DELTA_H
+
+// rsync-like updates of large files that change a little.
+//
+// SITE SIGS <file> [<block size>] sends on the data connection one line
+// "<size of the file> <block size>" then, for each block of the file,
+//   "<index> <weak checksum> <strong checksum>"
+// in hexadecimal: the weak checksum is the rolling one of rsync, the
+// strong one the first 8 bytes of the SHA-256 of the block.
+//
+// After SITE DELTA [<block size>], the next STOR receives instructions
+// instead of the file itself. The new file is rebuilt from them and from
+// the blocks of the file it replaces, into "<file><FTP_DELTA_EXT>" that is
+// renamed over the old file once the stream is complete. All numbers are
+// 32 bits big endian:
+//   'C' <first block> <count>   copy blocks of the old file
+//   'L' <length> <bytes>        literal data
+//
+// Include through FtpServer.h.
+
+#ifndef FTP_DELTA_BLOCK
+#define FTP_DELTA_BLOCK 1024 // default block size of SITE SIGS and SITE DELTA
+#endif
+#ifndef FTP_DELTA_EXT
+#define FTP_DELTA_EXT ".ftpd" // suffix of the file rebuilt by a delta STOR
+#endif
+
+// Weak checksum of rsync, updated a chunk at a time
+class FtpBlockSum
+{
+public:
+  void begin() { a = b = 0; }
+  void update(const uint8_t *data, size_t len)
+  {
+    while (len--)
+    {
+      a += *data++;
+      b += a;
+    }
+  }
+  uint32_t value() { return (a & 0xFFFF) | (b << 16); }
+
+private:
+  uint32_t a, b;
+};
+
+// Rebuilds a file from a delta stream and the blocks of the old file
+class FtpDeltaDecoder
+{
+public:
+  boolean begin(const char *basisPath, uint16_t blockSize);
+  void end();
+
+  // Read at most maxRead bytes of instructions from `in` and put the
+  // bytes of the new file they give in out. Returns the number of bytes
+  // put in out, -1 if the stream is invalid.
+  int32_t step(FtpConnection &in, uint32_t maxRead, uint8_t *out, uint16_t size);
+
+  uint32_t lastRead() { return readCount; } // bytes read by the last step()
+  boolean copying() { return op == 'C' && remain > 0; }
+  boolean betweenInstructions() { return op == 0 && have == 0; }
+
+private:
+  File basis;
+  uint32_t basisSize;
+  uint16_t block;
+  uint8_t header[9]; // instruction being received
+  uint8_t have;      // bytes of header received
+  char op;           // instruction in progress, 0 between instructions
+  uint32_t remain;   // bytes left to copy or to receive for op
+  uint32_t readCount;
+};
+
+#endif // FTP_DELTA_H
@@ -0,0 +1,342 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Lightweight directory iterator
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpServer.h"
+
+#ifndef ESP8266
+#include <sys/stat.h>
+#endif
+
+/*******************************************************************************
+ **                                 WILDCARDS                                  **
+ *******************************************************************************/
+
+// The ']' closing the class that starts at p, NULL if there is none and
+// the '[' is a plain character. A ']' right after "[" or "[!" is part of
+// the class.
+static const char *classEnd(const char *p, const char *end)
+{
+  const char *q = p + 1;
+  if (q < end && (*q == '!' || *q == '^'))
+    q++;
+  for (const char *first = q; q < end; q++)
+    if (*q == ']' && q != first)
+      return q;
+  return NULL;
+}
+
+// End of the pattern element at p, NULL if it does not match c
+static const char *matchOne(const char *p, const char *end, char c)
+{
+  if (*p == '?')
+    return p + 1;
+  const char *close = *p == '[' ? classEnd(p, end) : NULL;
+  if (close != NULL)
+  {
+    const char *q = p + 1;
+    boolean negate = *q == '!' || *q == '^';
+    boolean found = false;
+    for (q += negate; q < close; q++)
+    {
+      if (q + 2 < close && q[1] == '-')
+      {
+        found |= c >= q[0] && c <= q[2];
+        q += 2;
+      }
+      else
+        found |= c == *q;
+    }
+    return found != negate ? close + 1 : NULL;
+  }
+  return *p == c ? p + 1 : NULL;
+}
+
+// Pattern [p, pEnd) against name [n, nEnd), backtracking to the last '*'
+static boolean matchRange(const char *p, const char *pEnd, const char *n, const char *nEnd)
+{
+  const char *starP = NULL, *starN = NULL;
+  while (n < nEnd)
+  {
+    if (p < pEnd && *p == '*')
+    {
+      starP = ++p;
+      starN = n;
+      continue;
+    }
+    const char *next = p < pEnd ? matchOne(p, pEnd, *n) : NULL;
+    if (next != NULL)
+    {
+      p = next;
+      n++;
+    }
+    else if (starP != NULL)
+    {
+      p = starP;
+      n = ++starN;
+    }
+    else
+      return false;
+  }
+  while (p < pEnd && *p == '*')
+    p++;
+  return p == pEnd;
+}
+
+boolean FtpGlob::isPattern(const char *s)
+{
+  return strpbrk(s, "*?[") != NULL;
+}
+
+boolean FtpGlob::compile(const char *p)
+{
+  size_t n = strlen(p);
+  if (n >= sizeof(pattern))
+    return false;
+  strcpy(pattern, p);
+  prefixLen = strcspn(pattern, "*?[");
+  // the suffix starts after the last wildcard element
+  const char *end = pattern + n, *afterWild = pattern;
+  for (const char *q = pattern; q < end;)
+    if (*q == '*' || *q == '?')
+      afterWild = ++q;
+    else if (*q == '[')
+    {
+      const char *close = classEnd(q, end);
+      afterWild = q = close != NULL ? close + 1 : q + 1;
+    }
+    else
+      q++;
+  suffixLen = end - afterWild;
+  if (prefixLen == n) // no wildcard
+    suffixLen = 0;
+  return true;
+}
+
+boolean FtpGlob::match(const char *name) const
+{
+  size_t n = strlen(name), p = strlen(pattern);
+  if (prefixLen == p)
+    return !strcmp(name, pattern);
+  if (n < (size_t)prefixLen + suffixLen ||
+      memcmp(name, pattern, prefixLen) ||
+      memcmp(name + n - suffixLen, pattern + p - suffixLen, suffixLen))
+    return false;
+  return matchRange(pattern + prefixLen, pattern + p - suffixLen, name + prefixLen, name + n - suffixLen);
+}
+
+/*******************************************************************************
+ **                             DIRECTORY ITERATOR                             **
+ *******************************************************************************/
+
+FtpDirIterator::FtpDirIterator()
+{
+  depth = 0;
+  descend = false;
+  filter = NULL;
+  path[0] = 0;
+}
+
+FtpDirIterator::~FtpDirIterator()
+{
+  close();
+}
+
+boolean FtpDirIterator::open(const char *dirPath, boolean recurse, const FtpGlob *glob)
+{
+  close();
+#ifdef ESP8266
+  int n = snprintf(path, sizeof(path), "%s", dirPath);
+#else
+  int n = snprintf(path, sizeof(path), "%s%s", FTP_FS_MOUNT, dirPath);
+#endif
+  if (n <= 0 || n >= (int)sizeof(path) - 2)
+    return false;
+  // no trailing '/' when opening, except for the root
+  if (n > 1 && path[n - 1] == '/')
+    path[--n] = 0;
+
+#ifdef ESP8266
+  if (strcmp(path, "/") && !FTP_FS.exists(path))
+    return false;
+  dirs[0] = FTP_FS.openDir(path);
+#else
+  dirs[0] = opendir(path);
+  if (dirs[0] == NULL)
+  {
+    FTPdebug("opendir %s impossible\n", path);
+    return false;
+  }
+#endif
+  if (path[n - 1] != '/')
+    path[n++] = '/';
+  path[n] = 0;
+  dirLen[0] = n;
+  depth = 1;
+  recursive = recurse;
+  filter = glob;
+  descend = false;
+  return true;
+}
+
+// Enter the directory of the current entry
+boolean FtpDirIterator::push()
+{
+  uint16_t n = strlen(path);
+  if (depth >= FTP_DIR_DEPTH || (size_t)n + 2 >= sizeof(path))
+    return false;
+#ifdef ESP8266
+  dirs[depth] = FTP_FS.openDir(path);
+#else
+  dirs[depth] = opendir(path);
+  if (dirs[depth] == NULL)
+    return false;
+#endif
+  path[n++] = '/';
+  path[n] = 0;
+  dirLen[depth++] = n;
+  return true;
+}
+
+void FtpDirIterator::pop()
+{
+  depth--;
+#ifdef ESP8266
+  dirs[depth] = Dir();
+#else
+  closedir(dirs[depth]);
+  dirs[depth] = NULL;
+#endif
+  path[dirLen[depth]] = 0;
+}
+
+boolean FtpDirIterator::next()
+{
+  if (descend)
+  {
+    descend = false;
+    push();
+  }
+  while (depth > 0)
+  {
+    uint16_t base = dirLen[depth - 1];
+    const char *entry;
+#ifdef ESP8266
+    if (!dirs[depth - 1].next())
+    {
+      pop();
+      continue;
+    }
+    String fn = dirs[depth - 1].fileName();
+    entry = fn.c_str();
+#else
+    struct dirent *de = readdir(dirs[depth - 1]);
+    if (de == NULL)
+    {
+      pop();
+      continue;
+    }
+    entry = de->d_name;
+    if (!strcmp(entry, ".") || !strcmp(entry, ".."))
+      continue;
+#endif
+    if (base + strlen(entry) + 2 >= sizeof(path))
+    {
+      FTPdebug("nom trop long ignoré : %s\n", entry);
+      continue;
+    }
+    strcpy(path + base, entry);
+
+    if (filter != NULL && !filter->match(entry))
+    {
+      // not returned, but its content may match
+      if (recursive)
+      {
+#ifdef ESP8266
+        boolean isDir = dirs[depth - 1].isDirectory();
+#else
+        struct stat st;
+        boolean isDir = de->d_type == DT_DIR;
+        if (de->d_type == DT_UNKNOWN && ::stat(path, &st) == 0)
+          isDir = S_ISDIR(st.st_mode);
+#endif
+        if (isDir)
+          push();
+      }
+      continue;
+    }
+
+#ifdef ESP8266
+    entrySize = dirs[depth - 1].fileSize();
+    entryTime = dirs[depth - 1].fileTime();
+    entryIsDir = dirs[depth - 1].isDirectory();
+#else
+    struct stat st;
+    entrySize = 0;
+    entryTime = 0;
+    entryIsDir = de->d_type == DT_DIR;
+    if (::stat(path, &st) == 0)
+    {
+      entryIsDir = S_ISDIR(st.st_mode);
+      entrySize = entryIsDir ? 0 : st.st_size;
+      entryTime = st.st_mtime;
+    }
+#endif
+    descend = recursive && entryIsDir;
+    return true;
+  }
+  return false;
+}
+
+void FtpDirIterator::close()
+{
+  while (depth > 0)
+    pop();
+  descend = false;
+}
+
+boolean FtpDirIterator::stat(const char *filePath, uint32_t *size, time_t *modified, boolean *isDir)
+{
+  *size = 0;
+  *modified = 0;
+  *isDir = false;
+#ifdef ESP8266
+  if (!strcmp(filePath, "/"))
+  {
+    *isDir = true;
+    return true;
+  }
+  File f = FTP_FS.open(filePath, "r");
+  if (!f)
+    return false;
+  *isDir = f.isDirectory();
+  *size = *isDir ? 0 : f.size();
+  *modified = f.getLastWrite();
+  f.close();
+  return true;
+#else
+  char statPath[FTP_CWD_SIZE + 32];
+  struct stat st;
+  snprintf(statPath, sizeof(statPath), "%s%s", FTP_FS_MOUNT, filePath);
+  if (::stat(statPath, &st) != 0)
+    return false;
+  *isDir = S_ISDIR(st.st_mode);
+  *size = *isDir ? 0 : st.st_size;
+  *modified = st.st_mtime;
+  return true;
+#endif
+}
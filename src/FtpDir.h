@@ -0,0 +1,108 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Lightweight directory iterator
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FTP_DIR_H
+#define FTP_DIR_H
+
+// Reads name, size, time and type of the entries of a directory without
+// opening a File for each of them.
+//   ESP8266 : Dir from FTP_FS.openDir(), metadata comes from the directory
+//   ESP32   : opendir()/readdir()/stat() on the VFS mount of FTP_FS
+//
+// When opened recursively, the tree is walked depth first: a directory is
+// returned before its content, and relName() gives the path of the entry
+// relative to the directory that was opened. Only one path buffer is used
+// whatever the depth, each level only costs a directory handle.
+//
+// A filter restricts the entries returned to the names it matches, before
+// they are stat()ed. A recursive walk still enters the directories that
+// don't match.
+//
+// Include through FtpServer.h, which defines the sizes used here.
+
+#ifndef ESP8266
+#include <dirent.h>
+#endif
+
+#ifndef FTP_DIR_DEPTH
+#define FTP_DIR_DEPTH 8 // max depth of a recursive listing
+#endif
+#ifndef FTP_GLOB_SIZE
+#define FTP_GLOB_SIZE 64 // max length of a wildcard pattern
+#endif
+
+// Shell wildcards: * ? and classes like [0-9] or [!~]. compile() notes the
+// literal prefix and suffix of the pattern ("2026*", "*.log"), most names
+// are rejected by comparing them before the wildcards are tried.
+class FtpGlob
+{
+public:
+  boolean compile(const char *pattern); // false if it is too long
+  boolean match(const char *name) const;
+
+  static boolean isPattern(const char *s);
+
+private:
+  char pattern[FTP_GLOB_SIZE];
+  uint8_t prefixLen; // literal characters before the first wildcard
+  uint8_t suffixLen; // literal characters after the last one
+};
+
+class FtpDirIterator
+{
+public:
+  FtpDirIterator();
+  ~FtpDirIterator();
+
+  boolean open(const char *path, boolean recursive = false, const FtpGlob *filter = NULL);
+  boolean next(); // false when there is no more entry
+  void close();
+  boolean isOpen() { return depth > 0; }
+
+  const char *name() { return depth ? path + dirLen[depth - 1] : ""; }
+  const char *relName() { return path + dirLen[0]; }
+  uint32_t size() { return entrySize; }
+  time_t modified() { return entryTime; }
+  boolean isDirectory() { return entryIsDir; }
+
+  // Metadata of a single file or directory, without listing its parent
+  static boolean stat(const char *path, uint32_t *size, time_t *modified, boolean *isDir);
+
+private:
+  boolean push();
+  void pop();
+
+#ifdef ESP8266
+  Dir dirs[FTP_DIR_DEPTH];
+#else
+  DIR *dirs[FTP_DIR_DEPTH];
+#endif
+  // "<mount><directory>/<sub directories>/<entry name>"
+  // dirLen[i] is the length of the part up to and including the '/' of level i
+  char path[FTP_CWD_SIZE + 32];
+  uint16_t dirLen[FTP_DIR_DEPTH];
+  uint8_t depth;
+  boolean recursive;
+  const FtpGlob *filter;
+  boolean descend; // current entry is a directory to enter on next()
+  uint32_t entrySize;
+  time_t entryTime;
+  boolean entryIsDir;
+};
+
+#endif // FTP_DIR_H
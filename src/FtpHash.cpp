@@ -0,0 +1,330 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * CRC32 / SHA-256 digests of transferred files
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpServer.h"
+
+/*******************************************************************************
+ **                                  SHA-256                                   **
+ *******************************************************************************/
+
+static const uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+void FtpSha256::begin()
+{
+  state[0] = 0x6a09e667;
+  state[1] = 0xbb67ae85;
+  state[2] = 0x3c6ef372;
+  state[3] = 0xa54ff53a;
+  state[4] = 0x510e527f;
+  state[5] = 0x9b05688c;
+  state[6] = 0x1f83d9ab;
+  state[7] = 0x5be0cd19;
+  count = 0;
+}
+
+void FtpSha256::transform(const uint8_t *data)
+{
+  uint32_t w[64];
+  uint32_t a, b, c, d, e, f, g, h;
+
+  for (uint8_t i = 0; i < 16; i++)
+    w[i] = ((uint32_t)data[4 * i] << 24) | ((uint32_t)data[4 * i + 1] << 16) |
+           ((uint32_t)data[4 * i + 2] << 8) | data[4 * i + 3];
+  for (uint8_t i = 16; i < 64; i++)
+  {
+    uint32_t s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  a = state[0];
+  b = state[1];
+  c = state[2];
+  d = state[3];
+  e = state[4];
+  f = state[5];
+  g = state[6];
+  h = state[7];
+  for (uint8_t i = 0; i < 64; i++)
+  {
+    uint32_t t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) + ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+    uint32_t t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+void FtpSha256::update(const uint8_t *data, size_t len)
+{
+  uint8_t used = count & 63;
+  count += len;
+  if (used)
+  {
+    uint8_t fill = 64 - used;
+    if (len < fill)
+    {
+      memcpy(block + used, data, len);
+      return;
+    }
+    memcpy(block + used, data, fill);
+    transform(block);
+    data += fill;
+    len -= fill;
+  }
+  while (len >= 64)
+  {
+    transform(data);
+    data += 64;
+    len -= 64;
+  }
+  memcpy(block, data, len);
+}
+
+void FtpSha256::finish(uint8_t digest[32])
+{
+  uint8_t used = count & 63;
+  uint64_t bits = (uint64_t)count << 3;
+
+  block[used++] = 0x80;
+  if (used > 56)
+  {
+    memset(block + used, 0, 64 - used);
+    transform(block);
+    used = 0;
+  }
+  memset(block + used, 0, 56 - used);
+  for (uint8_t i = 0; i < 8; i++)
+    block[63 - i] = bits >> (8 * i);
+  transform(block);
+
+  for (uint8_t i = 0; i < 8; i++)
+  {
+    digest[4 * i] = state[i] >> 24;
+    digest[4 * i + 1] = state[i] >> 16;
+    digest[4 * i + 2] = state[i] >> 8;
+    digest[4 * i + 3] = state[i];
+  }
+}
+
+/*******************************************************************************
+ **                                   CRC32                                    **
+ *******************************************************************************/
+
+// Half-byte table: 64 bytes of RAM instead of 1 KB for the usual one
+static const uint32_t crc32Nibble[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+
+void FtpCrc32::update(const uint8_t *data, size_t len)
+{
+  uint32_t c = crc;
+  while (len--)
+  {
+    c ^= *data++;
+    c = (c >> 4) ^ crc32Nibble[c & 15];
+    c = (c >> 4) ^ crc32Nibble[c & 15];
+  }
+  crc = c;
+}
+
+/*******************************************************************************
+ **                               HASHER / DIGEST                              **
+ *******************************************************************************/
+
+void FtpHasher::begin()
+{
+  crc.begin();
+  sha.begin();
+  size = 0;
+}
+
+void FtpHasher::update(const uint8_t *data, size_t len)
+{
+  crc.update(data, len);
+  sha.update(data, len);
+  size += len;
+}
+
+void FtpHasher::finish(FtpDigest &digest)
+{
+  digest.size = size;
+  digest.crc = crc.value();
+  sha.finish(digest.sha);
+}
+
+static boolean sideFilePath(char *side, const char *path)
+{
+  if (strlen(path) + strlen(FTP_HASH_EXT) >= FTP_CWD_SIZE)
+    return false;
+  strcpy(side, path);
+  strcat(side, FTP_HASH_EXT);
+  return true;
+}
+
+static int8_t hexDigit(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+void FtpDigest::toHex(char *hex, const uint8_t *bytes, uint8_t len)
+{
+  static const char digits[] = "0123456789abcdef";
+  for (uint8_t i = 0; i < len; i++)
+  {
+    *hex++ = digits[bytes[i] >> 4];
+    *hex++ = digits[bytes[i] & 15];
+  }
+  *hex = 0;
+}
+
+// Side file: "<size> <crc32> <sha256>\n", in hexadecimal except the size
+boolean FtpDigest::load(const char *path)
+{
+  char side[FTP_CWD_SIZE];
+  char line[8 + 10 + 64 + 4];
+  uint32_t fsize, sideSize;
+  time_t fileTime, sideTime;
+  boolean isDir;
+
+  if (!sideFilePath(side, path) ||
+      !FtpDirIterator::stat(path, &fsize, &fileTime, &isDir) || isDir ||
+      !FtpDirIterator::stat(side, &sideSize, &sideTime, &isDir))
+    return false;
+  // modified by the sketch after the digests were computed
+  if (fileTime != 0 && sideTime != 0 && fileTime > sideTime)
+    return false;
+
+  File f = FTP_FS.open(side, "r");
+  if (!f)
+    return false;
+  int16_t nb = f.readBytes(line, sizeof(line) - 1);
+  f.close();
+  if (nb <= 0)
+    return false;
+  line[nb] = 0;
+
+  char *p = line;
+  size = strtoul(p, &p, 10);
+  if (*p++ != ' ')
+    return false;
+  crc = strtoul(p, &p, 16);
+  if (*p++ != ' ')
+    return false;
+  for (uint8_t i = 0; i < 32; i++)
+  {
+    int8_t hi = hexDigit(p[2 * i]), lo = hexDigit(p[2 * i + 1]);
+    if (hi < 0 || lo < 0)
+      return false;
+    sha[i] = (hi << 4) | lo;
+  }
+  return size == fsize;
+}
+
+boolean FtpDigest::save(const char *path)
+{
+  char side[FTP_CWD_SIZE];
+  char hex[65];
+  if (!sideFilePath(side, path))
+    return false;
+  File f = FTP_FS.open(side, "w");
+  if (!f)
+    return false;
+  toHex(hex, sha, 32);
+  f.printf("%lu %08lx %s\n", (unsigned long)size, (unsigned long)crc, hex);
+  f.close();
+  if (FTP_DEDUP)
+    FtpDedup::record(path, *this);
+  FTPdebug("digests de %s enregistrés\n", path);
+  return true;
+}
+
+void FtpDigest::remove(const char *path)
+{
+  char side[FTP_CWD_SIZE];
+  if (sideFilePath(side, path) && FTP_FS.exists(side))
+    FTP_FS.remove(side);
+}
+
+void FtpDigest::rename(const char *from, const char *to)
+{
+  char sideFrom[FTP_CWD_SIZE], sideTo[FTP_CWD_SIZE];
+  if (sideFilePath(sideFrom, from) && FTP_FS.exists(sideFrom))
+  {
+    if (sideFilePath(sideTo, to))
+      FTP_FS.rename(sideFrom, sideTo);
+    else
+      FTP_FS.remove(sideFrom);
+  }
+}
+
+boolean FtpDigest::isSideFile(const char *name)
+{
+  size_t n = strlen(name), e = strlen(FTP_HASH_EXT);
+  return n > e && !strcmp(name + n - e, FTP_HASH_EXT);
+}
+
+boolean FtpDigest::removeSideFiles(const char *dir)
+{
+  FtpDirIterator it;
+  if (!it.open(dir))
+    return false;
+  while (it.next())
+    if (it.isDirectory() || !isSideFile(it.name()))
+      return false;
+  // one at a time, the directory is read again after each removal
+  char side[FTP_CWD_SIZE];
+  do
+  {
+    it.close();
+    if (!it.open(dir) || !it.next())
+      return true;
+    if (snprintf(side, sizeof(side), "%s/%s", dir, it.name()) >= (int)sizeof(side))
+      return false;
+  } while (FTP_FS.remove(side));
+  return false;
+}
@@ -0,0 +1,91 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * CRC32 / SHA-256 digests of transferred files
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FTP_HASH_H
+#define FTP_HASH_H
+
+// Digests are computed by HASH and XCRC, and with FTP_HASH_ON_TRANSFER
+// while the bytes go through doStore() / doRetrieve(), and kept in a small
+// side file "<file><FTP_HASH_EXT>", so that the next HASH or XCRC can be
+// answered without reading the file again. Side files are hidden from the
+// listings, follow their file on DELE and RNTO, and don't keep RMD from
+// removing a directory that has nothing else.
+//
+// Include through FtpServer.h, which defines the sizes used here.
+
+#ifndef FTP_HASH_EXT
+#define FTP_HASH_EXT ".ftph" // suffix of the side file holding the digests
+#endif
+
+class FtpSha256
+{
+public:
+  void begin();
+  void update(const uint8_t *data, size_t len);
+  void finish(uint8_t digest[32]);
+
+private:
+  void transform(const uint8_t *block);
+
+  uint32_t state[8];
+  uint32_t count; // bytes hashed (files are smaller than 4 GB)
+  uint8_t block[64];
+};
+
+class FtpCrc32
+{
+public:
+  void begin() { crc = 0xFFFFFFFF; }
+  void update(const uint8_t *data, size_t len);
+  uint32_t value() { return ~crc; }
+
+private:
+  uint32_t crc;
+};
+
+struct FtpDigest
+{
+  uint32_t size;
+  uint32_t crc;
+  uint8_t sha[32];
+
+  boolean load(const char *path); // false if there is no side file or it is stale
+  boolean save(const char *path);
+
+  static void remove(const char *path);
+  static void rename(const char *from, const char *to);
+  static boolean isSideFile(const char *name);
+  static boolean removeSideFiles(const char *dir); // false if dir holds something else
+  static void toHex(char *hex, const uint8_t *bytes, uint8_t len);
+};
+
+// CRC32 and SHA-256 of a stream of bytes, updated a chunk at a time
+class FtpHasher
+{
+public:
+  void begin();
+  void update(const uint8_t *data, size_t len);
+  void finish(FtpDigest &digest);
+
+private:
+  FtpCrc32 crc;
+  FtpSha256 sha;
+  uint32_t size;
+};
+
+#endif // FTP_HASH_H
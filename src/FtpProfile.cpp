@@ -0,0 +1,90 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Heap allocations and time of each command
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpServer.h"
+
+uint32_t FtpProfile::allocs = 0;
+uint32_t FtpProfile::allocBytes = 0;
+FtpProfileEntry FtpProfile::entries[FTP_PROFILE_ENTRIES];
+uint8_t FtpProfile::used = 0;
+uint32_t FtpProfile::beginAllocs = 0;
+uint32_t FtpProfile::beginBytes = 0;
+uint32_t FtpProfile::beginUs = 0;
+
+void FtpProfile::begin()
+{
+  beginAllocs = allocs;
+  beginBytes = allocBytes;
+  beginUs = FTP_MICROS();
+}
+
+void FtpProfile::end(const char *name)
+{
+  uint32_t us = FTP_MICROS() - beginUs;
+  FtpProfileEntry *e = entries;
+  while (e < entries + used && strncmp(e->name, name, sizeof(e->name) - 1))
+    e++;
+  if (e == entries + used)
+  {
+    if (used == FTP_PROFILE_ENTRIES)
+      return;
+    used++;
+    memset(e, 0, sizeof(*e));
+    strncpy(e->name, name, sizeof(e->name) - 1);
+  }
+  e->calls++;
+  e->allocs += allocs - beginAllocs;
+  e->bytes += allocBytes - beginBytes;
+  e->us += us;
+}
+
+void FtpProfile::reset()
+{
+  used = 0;
+}
+
+#if FTP_PROFILE
+
+// The functions given to the program by -Wl,--wrap
+extern "C"
+{
+  void *__real_malloc(size_t size);
+  void *__real_calloc(size_t n, size_t size);
+  void *__real_realloc(void *ptr, size_t size);
+
+  void *__wrap_malloc(size_t size)
+  {
+    FtpProfile::noteAlloc(size);
+    return __real_malloc(size);
+  }
+
+  void *__wrap_calloc(size_t n, size_t size)
+  {
+    FtpProfile::noteAlloc(n * size);
+    return __real_calloc(n, size);
+  }
+
+  void *__wrap_realloc(void *ptr, size_t size)
+  {
+    if (size > 0) // else a free()
+      FtpProfile::noteAlloc(size);
+    return __real_realloc(ptr, size);
+  }
+}
+
+#endif
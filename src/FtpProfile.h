@@ -0,0 +1,74 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Heap allocations and time of each command
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FTP_PROFILE_H
+#define FTP_PROFILE_H
+
+// With FTP_PROFILE, handleFTP() measures each command and each call of a
+// transfer: the allocations made meanwhile, the bytes they asked for and
+// the time taken. The totals are kept by name, the verb of the command
+// ("RETR") or the transfer status ("+RETR" for the chunks sent by RETR).
+//
+// The allocations are counted by wrappers of malloc, calloc and realloc,
+// the program must be linked with
+//   -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc
+// (build_flags of PlatformIO). They count the allocations of every task,
+// not only those of the server.
+//
+// Include through FtpServer.h.
+
+#ifndef FTP_PROFILE_ENTRIES
+#define FTP_PROFILE_ENTRIES 48 // names measured, the others are not kept
+#endif
+
+struct FtpProfileEntry
+{
+  char name[6];
+  uint32_t calls;
+  uint32_t allocs; // malloc, calloc and realloc
+  uint32_t bytes;  // asked by them
+  uint32_t us;
+};
+
+class FtpProfile
+{
+public:
+  static void noteAlloc(size_t size) // by the wrappers
+  {
+    allocs++;
+    allocBytes += size;
+  }
+
+  // One measure at a time, from begin() to end()
+  static void begin();
+  static void end(const char *name);
+
+  static uint8_t size() { return used; }
+  static const FtpProfileEntry *entry(uint8_t i) { return i < used ? &entries[i] : NULL; }
+  static void reset();
+
+  static uint32_t allocs;     // since boot
+  static uint32_t allocBytes;
+
+private:
+  static FtpProfileEntry entries[FTP_PROFILE_ENTRIES];
+  static uint8_t used;
+  static uint32_t beginAllocs, beginBytes, beginUs;
+};
+
+#endif // FTP_PROFILE_H
@@ -0,0 +1,49 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Token buckets for bandwidth shaping
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpServer.h"
+
+void FtpTokenBucket::setRate(uint32_t bytesPerSecond)
+{
+  rate = bytesPerSecond;
+  // an eighth of a second of traffic, but at least a full TCP segment
+  burst = rate / 8 > 1460 ? rate / 8 : 1460;
+  tokens = burst;
+  lastMillis = FTP_MILLIS();
+}
+
+uint32_t FtpTokenBucket::available(uint32_t wanted)
+{
+  if (rate == 0)
+    return wanted;
+  uint32_t now = FTP_MILLIS();
+  uint32_t added = (uint64_t)(now - lastMillis) * rate / 1000;
+  if (added > 0)
+  {
+    tokens = added >= burst - tokens ? burst : tokens + added;
+    lastMillis = now;
+  }
+  return tokens < wanted ? tokens : wanted;
+}
+
+void FtpTokenBucket::consume(uint32_t bytes)
+{
+  if (rate == 0)
+    return;
+  tokens = bytes >= tokens ? 0 : tokens - bytes;
+}
@@ -0,0 +1,46 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Token buckets for bandwidth shaping
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FTP_RATE_H
+#define FTP_RATE_H
+
+// A bucket fills with `rate` bytes per second, up to `burst` bytes. A
+// transfer may only move the bytes present in the bucket, doRetrieve()
+// and doStore() skip their turn when it is empty. Uploads are shaped by
+// not reading the socket: the TCP window closes and the client slows down.
+//
+// Include through FtpServer.h.
+
+class FtpTokenBucket
+{
+public:
+  FtpTokenBucket() : rate(0), burst(0), tokens(0), lastMillis(0) {}
+
+  void setRate(uint32_t bytesPerSecond);
+  uint32_t getRate() { return rate; }
+  uint32_t available(uint32_t wanted); // bytes allowed now, at most wanted
+  void consume(uint32_t bytes);
+
+private:
+  uint32_t rate;  // bytes per second, 0 for no limit
+  uint32_t burst; // max bytes in the bucket
+  uint32_t tokens;
+  uint32_t lastMillis;
+};
+
+#endif // FTP_RATE_H
@@ -29,9 +29,68 @@
 #include <WiFi.h>
 #endif
 
+#if FTP_OTA
+#ifdef ESP8266
+#include <Updater.h>
+#else
+#include <Update.h>
+#endif
+#endif
+
 //#warning fichier EspFtpServer.h
 WiFiServer ftpServer(FTP_CTRL_PORT);
-WiFiServer dataServer(FTP_DATA_PORT_PASV);
+
+FtpTokenBucket FtpServer::globalRateDown;
+FtpTokenBucket FtpServer::globalRateUp;
+FtpCache FtpServer::cache;
+FtpVirtualFiles FtpServer::virtualFiles;
+FtpAdmission FtpServer::admission;
+FtpSharedFiles FtpServer::sharedFiles;
+FtpXferLog FtpServer::xferLog;
+uint8_t FtpServer::transfersRunning = 0;
+
+// Update API of the cores, or nothing if FTP_OTA is 0
+
+#if FTP_OTA
+static boolean otaBegin(uint32_t size)
+{
+#ifdef ESP8266
+  // no size: the updater must not complete before the digest is checked
+  (void)size;
+  return Update.begin((ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000);
+#else
+  return Update.begin(size > 0 ? size : UPDATE_SIZE_UNKNOWN);
+#endif
+}
+
+static size_t otaWrite(uint8_t *data, size_t len) { return Update.write(data, len); }
+
+static boolean otaEnd() { return Update.end(true); }
+
+static void otaAbort()
+{
+#ifdef ESP8266
+  Update.end(false); // image not finished, nothing is committed
+#else
+  Update.abort();
+#endif
+}
+
+static String otaError()
+{
+#ifdef ESP8266
+  return Update.getErrorString();
+#else
+  return String(Update.errorString());
+#endif
+}
+#else
+static boolean otaBegin(uint32_t) { return false; }
+static size_t otaWrite(uint8_t *, size_t) { return 0; }
+static boolean otaEnd() { return false; }
+static void otaAbort() {}
+static String otaError() { return "no OTA in this build"; }
+#endif
 
 void FtpServer::begin(String uname, String pword)
 {
@@ -39,144 +98,269 @@ void FtpServer::begin(String uname, String pword)
   _FTP_USER = uname;
   _FTP_PASS = pword;
 
-  ftpServer.begin();
-  delay(10);
-  dataServer.begin();
+  // the servers share the control port, each one has its passive data port
+  uint8_t index = admission.addServer();
+  if (index == 0)
+  {
+    ftpServer.begin();
+    delay(10);
+  }
+  dataPortPasv = FTP_DATA_PORT_PASV + index;
+  dataServer.begin(dataPortPasv);
   delay(10);
   millisTimeOut = (uint32_t)FTP_TIME_OUT * 60 * 1000;
-  millisDelay = 0;
+  millisDelay = FTP_MILLIS(); // no pause, whatever the uptime
   cmdStatus = cInit;
+  sessionTask = 0;
+  otaDone = false;
   iniVariables();
   FTPdebug("Initialisation du serveur FTP\n");
 }
 
+void FtpServer::setTls(FtpTls *provider, boolean required)
+{
+  tls = provider;
+  tlsRequired = required && provider != NULL;
+}
+
+void FtpServer::setRateLimit(uint32_t downBytesPerSec, uint32_t upBytesPerSec)
+{
+  rateDown.setRate(downBytesPerSec);
+  rateUp.setRate(upBytesPerSec);
+}
+
+void FtpServer::setGlobalRateLimit(uint32_t downBytesPerSec, uint32_t upBytesPerSec)
+{
+  globalRateDown.setRate(downBytesPerSec);
+  globalRateUp.setRate(upBytesPerSec);
+}
+
+void FtpServer::setCacheSize(uint32_t bytes, uint32_t maxFileSize)
+{
+  cache.setSize(bytes);
+  cache.setMaxFileSize(maxFileSize);
+}
+
+void FtpServer::cacheInvalidate(const char *path)
+{
+  cache.invalidate(path);
+}
+
+boolean FtpServer::addVirtualFile(const char *path, FtpVirtualRead read, FtpVirtualSize size, void *arg)
+{
+  return virtualFiles.add(path, read, size, arg);
+}
+
+void FtpServer::removeVirtualFile(const char *path)
+{
+  virtualFiles.remove(path);
+}
+
+void FtpServer::flushTransferLog()
+{
+  if (FTP_XFERLOG && xferLog.flush())
+  {
+    cache.invalidate(FTP_XFERLOG_PATH);
+    cache.invalidate(FTP_XFERLOG_PATH ".1");
+  }
+}
+
 void FtpServer::iniVariables()
 {
   // Default for data port
-  dataPort = FTP_DATA_PORT_PASV;
+  dataPort = dataPortPasv;
 
   // Default Data connection is Active
   dataPassiveConn = true;
+  dataWaiting = false;
+  epsvAll = false;
+  listStat = false;
 
   // Set the root directory
   strcpy(cwdName, "/");
 
   rnfrCmd = false;
-  transferStatus = 0;
+  cacheEntry = NULL;
+  virtualFile = NULL;
+  segment = NULL;
+  restart = false;
+  restartPos = 0;
+  transferOffset = 0;
+  transferComplete = false;
+  hashCrc = false;
+  pbszDone = false;
+  protPrivate = false;
+  allocSize = 0;
+  deltaBlock = 0;
+  otaStore = false;
+  otaCheck = false;
+  asciiType = false;
+  asciiTransfer = false;
+  transferStatus = tIdle;
+  transferTask = 0;
+  sendLeft = 0;
 }
 
 boolean FtpServer::handleFTP()
 {
-
- // if ((int32_t)(millisDelay - millis()) > 0)   return transfer_en_cours;
+  // a session closed by the client no longer holds a server for the admission
+  if (cmdStatus == cInit)
+    endSession();
+  // pause after a failed login or a timeout
+  if ((int32_t)(millisDelay - FTP_MILLIS()) > 0)
+    return transfer_en_cours;
 
   transfer_en_cours = false;
-  if (ftpServer.hasClient())
+  // a busy server leaves new connections to an idle one, if there is one,
+  // but one closing its session will take them in a moment
+  if (ftpServer.hasClient() && (cmdStatus == cCheck || (cmdStatus > cCheck && admission.full())))
+    acceptClient();
+  // never a flash write for the log while a server moves data
+  countTransfer();
+  if (FTP_XFERLOG && transfersRunning == 0 && xferLog.due())
+    flushTransferLog();
+
+  if (!runSession())
+    cmdStatus = cInit; // the next call starts another one
+
+  if (transferStatus != tIdle) // data connection, then transfer, listing, digest or copy
   {
-    client.stop();
-    client = ftpServer.accept();
+#if FTP_PROFILE
+    // "+" and the verb that started it
+    static const char *const steps[] = {"", "+RETR", "+STOR", "+LIST", "+HASH", "+CPY", "+SIGS", "+RMT"};
+    uint8_t step = transferStatus;
+    FtpProfile::begin();
+#endif
+    transfer_en_cours = runTransfer();
+#if FTP_PROFILE
+    FtpProfile::end(steps[step]);
+#endif
+    countTransfer();
   }
-
-  if (cmdStatus == cInit)
+  else if (cmdStatus > cCheck && !((int32_t)(millisEndConnection - FTP_MILLIS()) > 0))
   {
-    if (client.connected())
-      disconnectClient();
-    cmdStatus = cWait;
+    client.println("530 Timeout");
+    millisDelay = FTP_MILLIS() + 200; // delay of 200 ms
+    cmdStatus = cInit;
+    sessionTask = 0;
   }
-  else if (cmdStatus == cWait) // Ftp server waiting for connection
-  {
-    abortTransfer();
-    iniVariables();
+  return transfer_en_cours;
+}
 
-    FTPdebug("FTP server en attente de connexion sur le port %d\n", FTP_CTRL_PORT);
+// The control connection, from the wait for a client to the end of its
+// session. A task as runTransfer(), that handleFTP() calls at each loop();
+// cmdStatus tells acceptClient() and the timeout where it is.
+//
+//  return false once the session is over
+boolean FtpServer::runSession()
+{
+  FTP_TASK_BEGIN(sessionTask);
+  if (client.connected())
+    disconnectClient();
+  abortTransfer();
+  endSession();
+  iniVariables();
 
-    cmdStatus = cCheck;
-  }
-  else if (cmdStatus == cCheck) // Ftp server idle
+  FTPdebug("FTP server en attente de connexion sur le port %d\n", FTP_CTRL_PORT);
+
+  cmdStatus = cCheck;
+  FTP_TASK_WAIT_UNTIL(sessionTask, client.connected()); // taken by acceptClient()
+  clientConnected();
+  millisEndConnection = FTP_MILLIS() + 10 * 1000; // wait client id during 10 s.
+  cmdStatus = cUserId;
+  FTP_TASK_WAIT_UNTIL(sessionTask, (sessionRc = controlLine()) != 0);
+  if (sessionRc < 0 || !userIdentity())
+    FTP_TASK_EXIT(sessionTask);
+  cmdStatus = cPassword;
+  FTP_TASK_WAIT_UNTIL(sessionTask, (sessionRc = controlLine()) != 0);
+  if (sessionRc < 0 || !userPassword())
+    FTP_TASK_EXIT(sessionTask);
+  cmdStatus = cLoginOk;
+  millisEndConnection = FTP_MILLIS() + millisTimeOut;
+  while (true)
   {
-    if (client.connected()) // A client connected
-    {
-      clientConnected();
-      millisEndConnection = millis() + 10 * 1000; // wait client id during 10 s.
-      cmdStatus = cUserId;
-    }
+    FTP_TASK_WAIT_UNTIL(sessionTask, (sessionRc = controlLine()) != 0);
+    if (sessionRc < 0)
+      break;
+#if FTP_PROFILE
+    FtpProfile::begin();
+#endif
+    boolean ok = processCommand();
+#if FTP_PROFILE
+    FtpProfile::end(command);
+#endif
+    if (!ok)
+      break;
+    millisEndConnection = FTP_MILLIS() + millisTimeOut;
   }
-  else if (readChar() > 0) // got response
+  FTP_TASK_END(sessionTask);
+}
+
+// Next command line of the client. The TLS negotiation after AUTH TLS and
+// the security commands, allowed before and after the login, are handled
+// here.
+//
+//  return:
+//    -1 if the session is over
+//     0 if there is no line yet
+//     1 when command and parameters hold one
+int8_t FtpServer::controlLine()
+{
+  if (client.handshaking()) // TLS negotiation after AUTH TLS
+    return client.handshake() < 0 ? -1 : 0;
+  // SITE CPY, RMTREE or STAT <path> hold the commands
+  if (transferStatus != tCopy && transferStatus != tRmtree && !(transferStatus == tList && listStat) &&
+      readChar() > 0)
   {
-    if (cmdStatus == cUserId) // Ftp server waiting for user identity
-      if (userIdentity())
-      {
-        cmdStatus = cPassword;
-      }
-      else
-      {
-        cmdStatus = cInit;
-      }
-    else if (cmdStatus == cPassword) // Ftp server waiting for user registration
-      if (userPassword())
-      {
-        cmdStatus = cLoginOk;
-        millisEndConnection = millis() + millisTimeOut;
-      }
-      else
-      {
-        cmdStatus = cInit;
-      }
-    else if ((cmdStatus == cLoginOk)) // Ftp server waiting for user command
-    {
-      if (!processCommand())
-      {
-        cmdStatus = cInit;
-      }
-      else
-      {
-        millisEndConnection = millis() + millisTimeOut;
-      }
-    }
+    if (strcmp(command, "AUTH") && strcmp(command, "PBSZ") && strcmp(command, "PROT"))
+      return 1;
+    return processSecurityCommand() ? 0 : -1;
   }
-  else if (!client.connected() || !client)
+  if (!client.connected() || !client)
   {
-    cmdStatus = cWait;
     FTPdebug("client disconnected\n");
+    return -1;
   }
+  return 0;
+}
 
-  if (transferStatus == 1) // Retrieve data
-  {
-    if (!doRetrieve())
-    {
-      transferStatus = 0;
-    }
-    else
-    {
-      transfer_en_cours = true;
-    }
-  }
-  else if (transferStatus == 2) // Store data
-  {
-    if (!doStore())
-    {
-      transferStatus = 0;
-    }
-    else
-    {
-      transfer_en_cours = true;
-    }
-  }
-  else if (cmdStatus > 2 && !((int32_t)(millisEndConnection - millis()) > 0))
+// Take a new connection, or refuse it with a single line, before the banner
+void FtpServer::acceptClient()
+{
+  WiFiClient incoming = ftpServer.accept();
+  IPAddress ip = incoming.remoteIP();
+  const char *refusal = admission.check(ip);
+  if (refusal == NULL && cmdStatus != cCheck)
+    refusal = "421 Too many users, try again later";
+  if (refusal != NULL)
   {
-    client.println("530 Timeout");
-    millisDelay = millis() + 200; // delay of 200 ms
-    cmdStatus = cInit;
+    incoming.print(refusal);
+    incoming.print("\r\n");
+    incoming.stop();
+    return;
   }
-  return transfer_en_cours;
+  client = incoming;
+  clientIp = ip;
+  sessionOpen = true;
+  loggedIn = false;
+  admission.opened();
+}
+
+// Account for the end of the session, a failure if there was no login
+void FtpServer::endSession()
+{
+  if (!sessionOpen)
+    return;
+  sessionOpen = false;
+  admission.closed(clientIp, loggedIn);
 }
 
 void FtpServer::clientConnected()
 {
   FTPdebug("Client connected!\n");
 
-  client.println("220 --- Welcome to FTP for ESP8266/ESP32 ---");
-  client.println("220 --- By le Sha ---");
+  client.println("220- --- Welcome to FTP for ESP8266/ESP32 ---");
+  client.println("220- --- By le Sha ---");
   client.println("220 --- Version " + String(FTP_SERVER_VERSION) + " ---");
   iCL = 0;
 }
@@ -188,6 +372,7 @@ void FtpServer::disconnectClient()
   abortTransfer();
   client.println("221 Goodbye");
   client.stop();
+  endSession();
 }
 
 boolean FtpServer::userIdentity()
@@ -199,6 +384,10 @@ boolean FtpServer::userIdentity()
     client.println("500 Syntax error");
     FTPdebug("500 commande USER attendue\n");
   }
+  else if (tlsRequired && !client.secure())
+  {
+    client.println("530 TLS required, send AUTH TLS first");
+  }
   else
   {
     if (strcmp(parameters, _FTP_USER.c_str()))
@@ -214,7 +403,7 @@ boolean FtpServer::userIdentity()
       return true;
     }
   }
-  millisDelay = millis() + 100; // delay of 100 ms
+  millisDelay = FTP_MILLIS() + 100; // delay of 100 ms
   return false;
 }
 
@@ -235,12 +424,81 @@ boolean FtpServer::userPassword()
   {
     FTPdebug("Password OK. En attente de commandes.\n");
     client.println("230 OK.");
+    loggedIn = true;
+    admission.loggedIn(clientIp);
     return true;
   }
-  millisDelay = millis() + 100; // delay of 100 ms
+  millisDelay = FTP_MILLIS() + 100; // delay of 100 ms
   return false;
 }
 
+// AUTH, PBSZ and PROT (RFC 4217), accepted before and after the login
+//
+//  return:
+//    false if the TLS handshake of the control connection failed
+
+boolean FtpServer::processSecurityCommand()
+{
+  FTPdebug("cmnd = %s %s\n", command, parameters);
+  //
+  //  AUTH - Authentication/Security Mechanism
+  //
+  if (!strcmp(command, "AUTH"))
+  {
+    if (tls == NULL)
+      client.println("502 TLS not available");
+    else if (strcasecmp(parameters, "TLS") && strcasecmp(parameters, "TLS-C") && strcasecmp(parameters, "SSL"))
+      client.println("504 Only AUTH TLS is supported");
+    else if (client.secure())
+      client.println("503 Already using TLS");
+    else
+    {
+      // the handshake is carried on by handleFTP()
+      client.println("234 AUTH TLS OK");
+      if (!client.startTls(tls))
+        return false;
+      pbszDone = false;
+      protPrivate = false;
+    }
+  }
+  //
+  //  PBSZ - Protection Buffer Size, always 0 with TLS
+  //
+  else if (!strcmp(command, "PBSZ"))
+  {
+    if (!client.secure())
+      client.println("503 Send AUTH TLS first");
+    else
+    {
+      pbszDone = true;
+      client.println("200 PBSZ=0");
+    }
+  }
+  //
+  //  PROT - Data Channel Protection Level, C(lear) or P(rivate)
+  //
+  else if (!strcmp(command, "PROT"))
+  {
+    if (!pbszDone)
+      client.println("503 Send PBSZ first");
+    else if (!strcasecmp(parameters, "P"))
+    {
+      protPrivate = true;
+      client.println("200 Protection level set to P");
+    }
+    else if (!strcasecmp(parameters, "C"))
+    {
+      protPrivate = false;
+      client.println("200 Protection level set to C");
+    }
+    else if (!strcasecmp(parameters, "S") || !strcasecmp(parameters, "E"))
+      client.println("536 Only C and P are supported");
+    else
+      client.println("504 Unknown protection level");
+  }
+  return true;
+}
+
 boolean FtpServer::processCommand()
 {
   ///////////////////////////////////////
@@ -249,12 +507,27 @@ boolean FtpServer::processCommand()
   //                                   //
   ///////////////////////////////////////
 
+  //
+  //  The commands that start a transfer wait for the one in progress,
+  //  whose file and state they would replace
+  //
+  if (transferStatus != tIdle && (!strcmp(command, "RETR") || !strcmp(command, "STOR") ||
+                             !strcmp(command, "LIST") || !strcmp(command, "MLSD") || !strcmp(command, "NLST")))
+  {
+    FTPdebug("cmnd = %s %s\n", command, parameters);
+    client.println("450 Transfer in progress, try again later");
+  }
   //
   //  CDUP - Change to Parent Directory
   //
-  if (!strcmp(command, "CDUP"))
+  else if (!strcmp(command, "CDUP"))
   {
     FTPdebug("cmnd = %s\n", command);
+    char *p = strrchr(cwdName, '/');
+    if (p == cwdName)
+      cwdName[1] = 0;
+    else if (p != NULL)
+      *p = 0;
     client.println("250 Ok. Current directory is " + String(cwdName));
   }
   //
@@ -262,13 +535,22 @@ boolean FtpServer::processCommand()
   //
   else if (!strcmp(command, "CWD"))
   {
-    //char path[FTP_CWD_SIZE];
+    char path[FTP_CWD_SIZE];
     FTPdebug("cmnd = %s\n", command);
     if (strcmp(parameters, ".") == 0) // 'CWD .' is the same as PWD command
       client.println("257 \"" + String(cwdName) + "\" is your current directory");
-    else
+    else if (makePath(path))
     {
-      client.println("250 Ok. Current directory is " + String(cwdName));
+      uint32_t fsize;
+      time_t mtime;
+      boolean isDir;
+      if (!FtpDirIterator::stat(path, &fsize, &mtime, &isDir) || !isDir)
+        client.println("550 Can't change directory to " + String(parameters));
+      else
+      {
+        strcpy(cwdName, path);
+        client.println("250 Ok. Current directory is " + String(cwdName));
+      }
     }
   }
   //
@@ -314,14 +596,27 @@ boolean FtpServer::processCommand()
   else if (!strcmp(command, "PASV"))
   {
     FTPdebug("cmnd = %s\n", command);
+    if (tlsRequired && !protPrivate)
+    {
+      client.println("521 Data connections must be protected, send PROT P");
+      return true;
+    }
+    if (epsvAll)
+    {
+      client.println("503 Only EPSV after EPSV ALL");
+      return true;
+    }
     if (data.connected())
     {
       data.stop();
     }
+    // a connection left by a command that failed before taking it
+    while (dataServer.hasClient())
+      dataServer.accept().stop();
     //dataServer.begin();
     //dataIp = Ethernet.localIP();
     dataIp = client.localIP();
-    dataPort = FTP_DATA_PORT_PASV;
+    dataPort = dataPortPasv;
     //data.connect( dataIp, dataPort );
     //data = dataServer.available();
 
@@ -340,23 +635,89 @@ boolean FtpServer::processCommand()
     if (data)
       data.stop();
     // get IP of data client
-    dataIp[0] = atoi(parameters);
-    char *p = strchr(parameters, ',');
-    for (uint8_t i = 1; i < 4; i++)
+    char *p = parameters;
+    for (uint8_t i = 0; i < 4 && p != NULL; i++)
     {
-      dataIp[i] = atoi(++p);
+      dataIp[i] = atoi(p);
       p = strchr(p, ',');
+      if (p != NULL)
+        p++;
     }
     // get port of data client
-    dataPort = 256 * atoi(++p);
-    p = strchr(p, ',');
-    dataPort += atoi(++p);
+    if (p != NULL)
+    {
+      dataPort = 256 * atoi(p);
+      p = strchr(p, ',');
+    }
+    if (p != NULL)
+      dataPort += atoi(++p);
     if (p == NULL)
       client.println("501 Can't interpret parameters");
+    else
+      activeMode();
+  }
+  //
+  //  EPRT - Extended Data Port, "EPRT |1|<ip>|<port>|" (RFC 2428)
+  //
+  else if (!strcmp(command, "EPRT"))
+  {
+    FTPdebug("cmnd = %s %s\n", command, parameters);
+    if (data)
+      data.stop();
+    char d = parameters[0];
+    char *p = NULL, *ip = NULL, *port = NULL;
+    if (d != 0) // else parameters + 1 is past the end of the line
+    {
+      p = parameters + 1;
+      ip = strchr(p, d);
+      port = ip != NULL ? strchr(ip + 1, d) : NULL;
+    }
+    uint8_t n = 0;
+    if (port == NULL || strchr(port + 1, d) == NULL)
+      client.println("501 Can't interpret parameters");
+    else if (atoi(p) != 1)
+      client.println("522 Network protocol not supported, use (1)");
+    else
+    {
+      // dotted address between the 2nd and 3rd delimiters
+      for (p = ip + 1; n < 4 && p < port; n++)
+      {
+        dataIp[n] = atoi(p);
+        while (p < port && *p != '.')
+          p++;
+        p++;
+      }
+      dataPort = atoi(port + 1);
+      if (n < 4 || dataPort == 0)
+        client.println("501 Can't interpret parameters");
+      else
+        activeMode();
+    }
+  }
+  //
+  //  EPSV - Extended Passive Mode (RFC 2428)
+  //
+  else if (!strcmp(command, "EPSV"))
+  {
+    FTPdebug("cmnd = %s %s\n", command, parameters);
+    if (!strcasecmp(parameters, "ALL"))
+    {
+      epsvAll = true;
+      client.println("200 EPSV ALL ok");
+    }
+    else if (parameters[0] != 0 && strcmp(parameters, "1"))
+      client.println("522 Network protocol not supported, use (1)");
+    else if (tlsRequired && !protPrivate)
+      client.println("521 Data connections must be protected, send PROT P");
     else
     {
-      client.println("200 PORT command successful");
-      dataPassiveConn = false;
+      if (data.connected())
+        data.stop();
+      while (dataServer.hasClient())
+        dataServer.accept().stop();
+      dataPort = dataPortPasv;
+      dataPassiveConn = true;
+      client.println("229 Entering Extended Passive Mode (|||" + String(dataPort) + "|)");
     }
   }
   //
@@ -378,10 +739,16 @@ boolean FtpServer::processCommand()
   else if (!strcmp(command, "TYPE"))
   {
     FTPdebug("cmnd = %s %s\n", command, parameters);
-    if (!strcmp(parameters, "A"))
-      client.println("200 TYPE is now ASII");
-    else if (!strcmp(parameters, "I"))
+    if (!strcmp(parameters, "A") || !strcmp(parameters, "A N"))
+    {
+      asciiType = true;
+      client.println("200 TYPE is now ASCII");
+    }
+    else if (!strcmp(parameters, "I") || !strcmp(parameters, "L 8"))
+    {
+      asciiType = false;
       client.println("200 TYPE is now 8-bit binary");
+    }
     else
       client.println("504 Unknow TYPE");
   }
@@ -412,12 +779,16 @@ boolean FtpServer::processCommand()
       client.println("501 No file name");
     else if (makePath(path))
     {
-      if (!FTP_FS.exists(path))
+      if (virtualFiles.find(path) != NULL)
+        client.println("550 " + String(parameters) + " is read only");
+      else if (!FTP_FS.exists(path))
         client.println("550 File " + String(parameters) + " not found");
       else
       {
         if (FTP_FS.remove(path))
         {
+          FtpDigest::remove(path);
+          cache.invalidate(path);
           FTPdebug("Fichier supprimé %s\n", parameters);
           client.println("250 Deleted " + String(parameters));
         }
@@ -428,210 +799,137 @@ boolean FtpServer::processCommand()
   }
   //
   //  LIST - List
+  //  MLSD - Listing for Machine Processing (see RFC 3659)
+  //  NLST - Name List
+  //
+  //  The listing itself is sent by doList(), one buffer per call of handleFTP()
+  //  Option -R lists the whole tree below the directory in the same
+  //  data connection, entries are then named by their relative path
+  //  Wildcards in the last component of the path ("*.log", "logs/2026*")
+  //  only list the entries whose name matches
+  //
   //
-  else if (!strcmp(command, "LIST"))
+  //  STAT - Status
+  //
+  //  Alone, the status of the session and of its transfer. With a path,
+  //  the listing of LIST as a 213 reply, without a data connection.
+  //
+  else if (!strcmp(command, "STAT") && *parameters == 0)
+  {
+    FTPdebug("cmnd = %s\n", command);
+    statusReply();
+  }
+  else if (!strcmp(command, "STAT") && transferStatus != tIdle)
   {
     FTPdebug("cmnd = %s %s\n", command, parameters);
-    if (!dataConnect())
-      client.println("425 No data connection");
-    else
+    client.println("450 Transfer in progress, try again later");
+  }
+  else if (!strcmp(command, "LIST") || !strcmp(command, "MLSD") || !strcmp(command, "NLST") || !strcmp(command, "STAT"))
+  {
+    FTPdebug("cmnd = %s %s\n", command, parameters);
+    char path[FTP_CWD_SIZE];
+    boolean onControl = command[0] == 'S';
+    boolean recursive = false;
+    char *param = parameters;
+    while (*param == '-') // options, like "-la" or "-R"
     {
-      client.println("150 Accepted data connection");
-      uint16_t nm = 0;
-#ifdef ESP8266
-      Dir dir = FTP_FS.openDir(cwdName);
-      // if( !FTP_FS.exists(cwdName))
-      //   client.println( "550 Can't open directory " + String(cwdName) );
-      // else
-      {
-        while (dir.next())
-        {
-          String fn, fs;
-          fn = dir.fileName();
-          //fn.remove(0, 1);       chgt suite au passage en littleFS
-          fs = String(dir.fileSize());
-          data.println("+r,s" + fs);
-          data.println(",\t" + fn);
-          nm++;
-        }
-        client.println("226 " + String(nm) + " matches total");
-      }
-#elif defined ESP32
-      File root = FTP_FS.open(cwdName);
-      if (!root)
+      while (*param != 0 && *param != ' ')
+        if (*param++ == 'R')
+          recursive = true;
+      while (*param == ' ')
+        param++;
+    }
+    char *last = strrchr(param, '/');
+    last = last != NULL ? last + 1 : param;
+    listFiltered = FtpGlob::isPattern(last);
+    if (listFiltered)
+    {
+      if (!listGlob.compile(last))
       {
-        client.println("550 Can't open directory " + String(cwdName));
-        // return;
+        client.println("501 Pattern too long");
+        return true;
       }
+      // the directory part, "/" for "/*.log"
+      if (last > param + 1)
+        last[-1] = 0;
       else
-      {
-        // if(!root.isDirectory()){
-        // 		Serial.println("Not a directory");
-        // 		return;
-        // }
+        *last = 0;
+    }
+    if (*param == 0)
+      strcpy(path, cwdName);
+    else if (!makePath(path, param))
+      return true;
 
-        File file = root.openNextFile();
-        while (file)
-        {
-          if (file.isDirectory())
-          {
-            data.println("+r,s <DIR> " + String(file.name()));
-            // Serial.print("  DIR : ");
-            // Serial.println(file.name());
-            // if(levels){
-            // 	listDir(fs, file.name(), levels -1);
-            // }
-          }
-          else
-          {
-            String fn, fs;
-            fn = file.name();
-            // fn.remove(0, 1);
-            fs = String(file.size());
-            data.println("+r,s" + fs);
-            data.println(",\t" + fn);
-            nm++;
-          }
-          file = root.openNextFile();
-        }
-        client.println("226 " + String(nm) + " matches total");
-      }
-#endif
-      data.stop();
+    uint32_t size;
+    time_t mtime;
+    boolean isDir;
+    if (onControl && !listFiltered && FtpDirIterator::stat(path, &size, &mtime, &isDir) && !isDir)
+    {
+      // STAT of a file: its directory, filtered by its name
+      char *base = strrchr(path, '/');
+      listFiltered = listGlob.compile(base + 1);
+      if (listFiltered)
+        *(base == path ? base + 1 : base) = 0;
     }
-  }
-  //
-  //  MLSD - Listing for Machine Processing (see RFC 3659)
-  //
-  else if (!strcmp(command, "MLSD"))
-  {
-    FTPdebug("cmnd = %s\n", command);
-    if (!dataConnect())
-      client.println("425 No data connection MLSD");
+    // a directory holding only virtual files need not exist on FTP_FS
+    uint8_t vi = 0;
+    const char *vname;
+    boolean hasVirtual = virtualFiles.next(path, recursive, vi, &vname) != NULL;
+    if (!onControl && !dataConnect())
+      client.println("425 No data connection");
     else
     {
-      client.println("150 Accepted data connection");
-      uint16_t nm = 0;
-#ifdef ESP8266
-      Dir dir = FTP_FS.openDir(cwdName);
-      //char dtStr[15];
-      //  if(!FTP_FS.exists(cwdName))
-      //    client.println( "550 Can't open directory " +String(parameters)+ );
-      //  else
+      if (!onControl)
+        client.println("150 Accepted data connection");
+      if (!dirIter.open(path, recursive, listFiltered ? &listGlob : NULL) && !hasVirtual)
       {
-        while (dir.next())
-        {
-          String fn, fs, fstr;
-          time_t fct;
-          tm tm_locale;
-          char strftime_buf[15];
-          fn = dir.fileName();
-          // FTPdebug("file = %s\n", (char*)fn.c_str());
-          //fn.remove(0, 1);          chgt suite au passage en littleFS
-          FTPdebug("file = %s\n", (char*)fn.c_str());
-          fs = String(dir.fileSize());
-          fct = dir.fileCreationTime();
-          FTPdebug("gmtime    : %s", asctime(gmtime(&fct)));
-          localtime_r(&fct, &tm_locale);
-          strftime(strftime_buf, sizeof(strftime_buf), "%Y%m%d%H%M%S", &tm_locale);
-          FTPdebug("strftime_buf    : %s\n",strftime_buf);
-          //data.println("Type=file;Size=" + fs + ";modify=" + "20230515160656" + ";" + fn);
-          data.print("Type=file;Size=" + fs + ";modify=");
-          data.print(strftime_buf);
-          data.println("; " + fn);
-          nm++;
-        }
-        client.println("226-options: -a -l");
-        client.println("226 " + String(nm) + " matches total");
+        client.println("550 Can't open directory " + String(path));
+        if (!onControl)
+          data.stop();
       }
-#elif defined ESP32
-      File root = FTP_FS.open(cwdName);
-      File file = root.openNextFile();
-      while (file)
+      else
       {
-        String fn, fs;
-        time_t fct;
-        tm tm_locale;
-        char strftime_buf[15];
-        fn = file.name();
-        //fn.remove(0, 1);   passage en littlefs
-        fs = String(file.size());
-        FTPdebug("file = %s\n", (char*)fn.c_str());
-        fct = file.getLastWrite();
-        FTPdebug("gmtime    : %s", asctime(gmtime(&fct)));
-        localtime_r(&fct, &tm_locale);
-        strftime(strftime_buf, sizeof(strftime_buf), "%Y%m%d%H%M%S", &tm_locale);
-        FTPdebug("strftime_buf    : %s\n",strftime_buf);
-        //data.println("Type=file;Size=" + fs + ";" + "modify=20000101160656;" + " " + fn);
-        data.print("Type=file;Size=" + fs + ";modify=");
-        data.print(strftime_buf);
-        data.println("; " + fn);
-        nm++;
-        // }
-        file = root.openNextFile();
+        if (onControl)
+          client.println("213-Status of " + String(path) + ":");
+        listStat = onControl;
+        listCommand = onControl ? 'L' : command[0];
+        listPending = false;
+        listCount = 0;
+        listRecursive = recursive;
+        listVirtual = 0;
+        virtualFile = NULL;
+        strcpy(transferPath, path);
+        millisBeginTrans = FTP_MILLIS();
+        bytesTransfered = 0;
+        transferStatus = tList;
       }
-      client.println("226-options: -a -l");
-      client.println("226 " + String(nm) + " matches total");
-      // }
-#endif
-      data.stop();
     }
   }
   //
-  //  NLST - Name List
+  //  NOOP
   //
-  else if (!strcmp(command, "NLST"))
+  else if (!strcmp(command, "NOOP"))
   {
-    FTPdebug("cmnd = %s %s\n", command, parameters);
-    if (!dataConnect())
-      client.println("425 No data connection");
-    else
-    {
-      client.println("150 Accepted data connection");
-      uint16_t nm = 0;
-#ifdef ESP8266
-      Dir dir = FTP_FS.openDir(cwdName);
-      // if( !FTP_FS.exists( cwdName ))
-      //   client.println( "550 Can't open directory " + String(parameters));
-      // else
-      {
-        while (dir.next())
-        {
-          data.println(dir.fileName());
-          nm++;
-        }
-        client.println("226 " + String(nm) + " matches total");
-      }
-#elif defined ESP32
-      File root = FTP_FS.open(cwdName);
-      if (!root)
-      {
-        client.println("550 Can't open directory " + String(cwdName));
-      }
-      else
-      {
-
-        File file = root.openNextFile();
-        while (file)
-        {
-          data.println(file.name());
-          nm++;
-          file = root.openNextFile();
-        }
-        client.println("226 " + String(nm) + " matches total");
-      }
-#endif
-      data.stop();
-    }
+    FTPdebug("cmnd = %s\n", command);
+    // dataPort = 0;
+    client.println("200 Zzz...");
   }
   //
-  //  NOOP
+  //  REST - Restart, offset of the next RETR or STOR
   //
-  else if (!strcmp(command, "NOOP"))
+  else if (!strcmp(command, "REST"))
   {
-    FTPdebug("cmnd = %s\n", command);
-    // dataPort = 0;
-    client.println("200 Zzz...");
+    FTPdebug("cmnd = %s %s\n", command, parameters);
+    char *end;
+    restartPos = strtoul(parameters, &end, 10);
+    restart = parameters[0] >= '0' && parameters[0] <= '9' && *end == 0;
+    if (!restart)
+    {
+      restartPos = 0;
+      client.println("501 Syntax: REST <offset>");
+    }
+    else
+      client.println("350 Restarting at " + String(restartPos));
   }
   //
   //  RETR - Retrieve
@@ -640,33 +938,79 @@ boolean FtpServer::processCommand()
   {
     FTPdebug("cmnd = %s %s\n", command, parameters);
     char path[FTP_CWD_SIZE];
+    uint32_t offset = restartPos;
+    restart = false;
+    restartPos = 0;
     if (strlen(parameters) == 0)
     {
       client.println("501 No file name");
     }
     else if (makePath(path))
     {
-      file = FTP_FS.open(path, "r");
-      if (!file)
+      // the log as it is now, with the lines still in RAM
+      if (FTP_XFERLOG && transfersRunning == 0 && !strcmp(path, FTP_XFERLOG_PATH))
+        flushTransferLog();
+      // Generated by the sketch or served from the cache when possible,
+      // without touching FTP_FS
+      virtualFile = virtualFiles.find(path);
+      if (virtualFile == NULL)
+        cacheEntry = cache.lookup(path);
+      if (virtualFile == NULL && cacheEntry == NULL)
+        file = FTP_FS.open(path, "r");
+      uint32_t fsize = virtualFile != NULL ? virtualFile->getSize() : cacheEntry != NULL ? cacheEntry->size : file.size();
+      if (virtualFile == NULL && cacheEntry == NULL && !file)
       {
         client.println("550 File " + String(parameters) + " not found");
-        client.println("450 Can't open " + String(parameters));
+      }
+      else if (offset > fsize && (virtualFile == NULL || virtualFile->size != NULL))
+      {
+        client.println("554 Restart position beyond the end of " + String(parameters));
       }
       else if (!dataConnect())
       {
         client.println("425 No data connection");
-        file.close();
       }
       else
       {
-        FTPdebug("Sending %s\n", parameters);
-
+        FTPdebug("Sending %s from %lu\n", parameters, (unsigned long)offset);
+
+        // only a whole file fills the cache and gives the digests
+        FtpDigest digest;
+        transferOffset = offset;
+        transferSize = fsize > offset ? fsize - offset : 0;
+        hashTransfer = false;
+        if (virtualFile == NULL && cacheEntry == NULL)
+        {
+          if (offset > 0)
+            file.seek(offset);
+          else if (!sharedFiles.busy(path))
+          {
+            cacheEntry = cache.reserve(path, transferSize); // filled by doRetrieve()
+            hashTransfer = FTP_HASH_ON_TRANSFER && !digest.load(path);
+          }
+        }
         client.println("150-Connected to port " + String(dataPort));
-        client.println("150 " + String(file.size()) + " bytes to download");
-        millisBeginTrans = millis();
+        if (virtualFile != NULL && virtualFile->size == NULL)
+          client.println("150 Generated content, size unknown");
+        else
+          client.println("150 " + String(transferSize) + " bytes to download");
+        strcpy(transferPath, path);
+        if (hashTransfer)
+          hasher.begin();
+        beginChunks();
+        asciiTransfer = asciiType;
+        asciiCR = false;
+        asciiRoom = FTP_CHUNK_MIN / 8;
+        millisBeginTrans = FTP_MILLIS();
         bytesTransfered = 0;
-        transferStatus = 1;
+        transferStatus = tRetrieve;
+        return true;
       }
+      file.close();
+      if (cacheEntry != NULL)
+        cache.release(cacheEntry);
+      cacheEntry = NULL;
+      virtualFile = NULL;
     }
   }
   //
@@ -677,6 +1021,12 @@ boolean FtpServer::processCommand()
     FTPdebug("cmnd = %s %s\n", command, parameters);
 
     char path[FTP_CWD_SIZE];
+    // after REST, even at 0, the file is not truncated: it may be one
+    // segment of an upload sent by several sessions
+    boolean segmented = restart;
+    uint32_t offset = restartPos;
+    restart = false;
+    restartPos = 0;
     if (strlen(parameters) == 0)
     {
       client.println("501 No file name");
@@ -684,8 +1034,58 @@ boolean FtpServer::processCommand()
     else if (makePath(path))
     {
       FTPdebug("path = %s\n", path);
-      file = FTP_FS.open(path, "w");
-      if (!file)
+      if (virtualFiles.find(path) != NULL)
+      {
+        deltaBlock = 0;
+        client.println("550 " + String(parameters) + " is read only");
+        return true;
+      }
+      if (FTP_OTA && !strcmp(path, FTP_OTA_PATH))
+      {
+        if (offset > 0)
+          client.println("554 The firmware is written from its start");
+        else
+          storeFirmware();
+        return true;
+      }
+      if (segmented && deltaBlock > 0)
+      {
+        deltaBlock = 0;
+        client.println("554 A delta can't be restarted");
+        return true;
+      }
+      if (!segmented && sharedFiles.busy(path))
+      {
+        deltaBlock = 0;
+        client.println("450 " + String(parameters) + " is being written by other sessions");
+        return true;
+      }
+      uint32_t avail = freeSpace();
+      uint32_t needed = allocSize;
+      allocSize = 0;
+      if (avail == 0 || needed > avail)
+      {
+        deltaBlock = 0;
+        client.println("452 Insufficient storage space, " + String(avail) + " bytes available");
+        return true;
+      }
+      // a delta is rebuilt aside, the old file is still needed for its blocks
+      strcpy(transferPath, path);
+      if (deltaBlock > 0)
+      {
+        if (strlen(path) + strlen(FTP_DELTA_EXT) >= FTP_CWD_SIZE || !delta.begin(path, deltaBlock))
+        {
+          deltaBlock = 0;
+          client.println("550 No file " + String(parameters) + " to apply the delta to");
+          return true;
+        }
+        strcat(transferPath, FTP_DELTA_EXT);
+      }
+      if (segmented)
+        segment = sharedFiles.open(path);
+      else
+        file = FTP_FS.open(transferPath, "w");
+      if (segmented ? segment == NULL : !file)
       {
         client.println("451 Can't open/create " + String(parameters));
       }
@@ -694,15 +1094,39 @@ boolean FtpServer::processCommand()
         client.println("425 No data connection");
         FTPdebug("425 Pas de connexion\n");
         file.close();
+        if (segment != NULL)
+          sharedFiles.release(segment);
+        segment = NULL;
       }
       else
       {
-        FTPdebug("Receiving %s\n", parameters);
+        FTPdebug("Receiving %s from %lu\n", parameters, (unsigned long)offset);
 
-        client.println("150 Connected to port " + String(dataPort));
-        millisBeginTrans = millis();
+        if (segmented)
+          client.println("150 Connected to port " + String(dataPort) + ", writing from " + String(offset));
+        else
+          client.println("150 Connected to port " + String(dataPort));
+        FtpDigest::remove(path);
+        cache.invalidate(path);
+        transferOffset = offset;
+        hashTransfer = (FTP_HASH_ON_TRANSFER || FTP_DEDUP) && !segmented; // the index is fed by the digests
+        if (hashTransfer)
+          hasher.begin();
+        beginChunks();
+        // a delta stream is binary whatever the TYPE
+        asciiTransfer = asciiType && deltaBlock == 0;
+        asciiCR = false;
+        millisBeginTrans = FTP_MILLIS();
         bytesTransfered = 0;
-        transferStatus = 2;
+        transferSize = 0;
+        transferStatus = tStore;
+        return true;
+      }
+      if (deltaBlock > 0)
+      {
+        delta.end();
+        FTP_FS.remove(transferPath);
+        deltaBlock = 0;
       }
     }
   }
@@ -712,7 +1136,21 @@ boolean FtpServer::processCommand()
   else if (!strcmp(command, "MKD"))
   {
     FTPdebug("cmnd = %s %s\n", command, parameters);
-    client.println("550 Can't create \"" + String(parameters)); // pas encore de support
+    char path[FTP_CWD_SIZE];
+    if (strlen(parameters) == 0)
+      client.println("501 No directory name");
+    else if (makePath(path))
+    {
+      if (FTP_FS.exists(path) || virtualFiles.find(path) != NULL)
+        client.println("550 " + String(parameters) + " already exists");
+      else if (FTP_FS.mkdir(path))
+      {
+        FTPdebug("Répertoire créé %s\n", path);
+        client.println("257 \"" + String(path) + "\" created");
+      }
+      else
+        client.println("550 Can't create \"" + String(parameters) + "\"");
+    }
   }
   //
   //  RMD - Remove a Directory
@@ -720,7 +1158,26 @@ boolean FtpServer::processCommand()
   else if (!strcmp(command, "RMD"))
   {
     FTPdebug("cmnd = %s %s\n", command, parameters);
-    client.println("501 Can't delete \"" + String(parameters));
+    char path[FTP_CWD_SIZE];
+    uint32_t size;
+    time_t mtime;
+    boolean isDir;
+    if (strlen(parameters) == 0)
+      client.println("501 No directory name");
+    else if (makePath(path))
+    {
+      if (!strcmp(path, "/"))
+        client.println("550 Can't remove the root directory");
+      else if (!FtpDirIterator::stat(path, &size, &mtime, &isDir) || !isDir)
+        client.println("550 Directory " + String(parameters) + " not found");
+      else if (FTP_FS.rmdir(path) || (FtpDigest::removeSideFiles(path) && FTP_FS.rmdir(path)))
+      {
+        FTPdebug("Répertoire supprimé %s\n", path);
+        client.println("250 Removed " + String(parameters));
+      }
+      else
+        client.println("550 Can't remove \"" + String(parameters) + "\", not empty?");
+    }
   }
   //
   //  RNFR - Rename From
@@ -733,7 +1190,9 @@ boolean FtpServer::processCommand()
       client.println("501 No file name");
     else if (makePath(buf))
     {
-      if (!FTP_FS.exists(buf))
+      if (virtualFiles.find(buf) != NULL)
+        client.println("550 " + String(parameters) + " is read only");
+      else if (!FTP_FS.exists(buf))
         client.println("550 File " + String(parameters) + " not found");
       else
       {
@@ -765,7 +1224,12 @@ boolean FtpServer::processCommand()
         FTPdebug("Renaming %s to %s\n", buf, path);
 
         if (FTP_FS.rename(buf, path))
+        {
+          FtpDigest::rename(buf, path);
+          cache.invalidate(buf);
+          cache.invalidate(path);
           client.println("250 File successfully renamed or moved");
+        }
         else
           client.println("451 Rename/move failure");
       }
@@ -787,9 +1251,57 @@ boolean FtpServer::processCommand()
     FTPdebug("cmnd = %s \n", command);
     client.println("211-Extensions suported:");
     client.println(" MLSD");
+    client.println(" MLST type*;size*;modify*;perm*;");
+    client.println(hashCrc ? " HASH SHA-256;CRC32*" : " HASH SHA-256*;CRC32");
+    client.println(" XCRC");
+    client.println(" AVBL");
+    client.println(" EPRT");
+    client.println(" EPSV");
+    client.println(" REST STREAM");
+    if (tls != NULL)
+    {
+      client.println(" AUTH TLS");
+      client.println(" PBSZ");
+      client.println(" PROT");
+    }
     client.println("211 End.");
   }
   //
+  //  MLST - Listing of a single entry (see RFC 3659)
+  //
+  else if (!strcmp(command, "MLST"))
+  {
+    FTPdebug("cmnd = %s %s\n", command, parameters);
+    char path[FTP_CWD_SIZE];
+    char line[FTP_CWD_SIZE + 80];
+    uint32_t fsize;
+    time_t mtime;
+    boolean isDir;
+    if (strlen(parameters) == 0)
+      strcpy(path, cwdName);
+    else if (!makePath(path))
+      return true;
+    FtpVirtualFile *vf = virtualFiles.find(path);
+    if (vf != NULL)
+    {
+      line[0] = ' ';
+      formatFacts(line + 1, sizeof(line) - 1, vf->getSize(), time(NULL), false, path, true, vf->size != NULL);
+      client.println("250-Listing " + String(path));
+      client.print(line);
+      client.println("250 End");
+    }
+    else if (!FtpDirIterator::stat(path, &fsize, &mtime, &isDir))
+      client.println("550 " + String(parameters) + " not found");
+    else
+    {
+      line[0] = ' ';
+      formatFacts(line + 1, sizeof(line) - 1, fsize, mtime, isDir, path);
+      client.println("250-Listing " + String(path));
+      client.print(line);
+      client.println("250 End");
+    }
+  }
+  //
   //  MDTM - File Modification Time (see RFC 3659)
   //
   else if (!strcmp(command, "MDTM"))
@@ -798,6 +1310,135 @@ boolean FtpServer::processCommand()
     client.println("550 Unable to retrieve time");
   }
 
+  //
+  //  ALLO - Allocate storage, "ALLO <size> [R <record size>]"
+  //
+  //  LittleFS can't preallocate a file: the size is checked against the
+  //  free space now, and again when the next STOR opens its file
+  //
+  else if (!strcmp(command, "ALLO"))
+  {
+    FTPdebug("cmnd = %s %s\n", command, parameters);
+    uint32_t avail = freeSpace();
+    if (!isdigit(parameters[0]))
+      client.println("501 Syntax: ALLO <size>");
+    else
+    {
+      allocSize = strtoul(parameters, NULL, 10);
+      if (allocSize > avail)
+      {
+        client.println("552 Insufficient storage space, " + String(avail) + " bytes available");
+        allocSize = 0;
+      }
+      else
+        client.println("200 " + String(allocSize) + " bytes reserved for next STOR");
+    }
+  }
+  //
+  //  AVBL - Available space (draft-peterson-streamlined-ftp-command-extensions)
+  //
+  else if (!strcmp(command, "AVBL"))
+  {
+    FTPdebug("cmnd = %s %s\n", command, parameters);
+    client.println("213 " + String(freeSpace()));
+  }
+  //
+  //  OPTS - Options of a command (only OPTS HASH)
+  //
+  else if (!strcmp(command, "OPTS"))
+  {
+    FTPdebug("cmnd = %s %s\n", command, parameters);
+    if (strncasecmp(parameters, "HASH", 4) || (parameters[4] != 0 && parameters[4] != ' '))
+      client.println("501 Option not understood");
+    else if (parameters[4] == 0)
+      client.println(hashCrc ? "200 CRC32" : "200 SHA-256");
+    else if (!strcasecmp(parameters + 5, "SHA-256"))
+    {
+      hashCrc = false;
+      client.println("200 SHA-256");
+    }
+    else if (!strcasecmp(parameters + 5, "CRC32"))
+    {
+      hashCrc = true;
+      client.println("200 CRC32");
+    }
+    else
+      client.println("501 Unknown algorithm, SHA-256 and CRC32 are supported");
+  }
+  //
+  //  HASH - Digest of a file (draft-bryan-ftpext-hash)
+  //  XCRC - CRC32 of a file, or of a range "XCRC <file> [<start> [<end>]]"
+  //
+  //  The digests saved when the file was transferred are used when they
+  //  cover the request, else doHash() reads the file, a buffer per call
+  //  of handleFTP()
+  //
+  else if (!strcmp(command, "HASH") || !strcmp(command, "XCRC"))
+  {
+    FTPdebug("cmnd = %s %s\n", command, parameters);
+    char path[FTP_CWD_SIZE];
+    uint32_t start = 0, end = 0xFFFFFFFF;
+    if (command[0] == 'X')
+    {
+      // optional range at the end of the parameters
+      uint32_t range[2];
+      uint8_t nr = 0;
+      char *sp;
+      while (nr < 2 && (sp = strrchr(parameters, ' ')) != NULL && isdigit(sp[1]))
+      {
+        range[nr++] = strtoul(sp + 1, NULL, 10);
+        *sp = 0;
+      }
+      if (nr == 1)
+        start = range[0];
+      else if (nr == 2)
+      {
+        start = range[1];
+        end = range[0];
+      }
+    }
+    if (strlen(parameters) == 0)
+      client.println("501 No file name");
+    // the state of the transfer in progress is not to be touched
+    else if (transferStatus != tIdle)
+      client.println("450 Transfer in progress, try again later");
+    else if (makePath(path))
+    {
+      FtpDigest digest;
+      uint32_t fsize;
+      time_t mtime;
+      boolean isDir;
+      if (!FtpDirIterator::stat(path, &fsize, &mtime, &isDir) || isDir)
+        client.println("550 File " + String(parameters) + " not found");
+      else if (start > fsize || start > end)
+        client.println("501 Invalid range");
+      else
+      {
+        if (end > fsize)
+          end = fsize;
+        if (start == 0 && end == fsize && digest.load(path))
+          hashReply(digest, command[0], path, end);
+        else
+        {
+          file = FTP_FS.open(path, "r");
+          if (!file || !file.seek(start))
+          {
+            file.close();
+            client.println("450 Can't open " + String(parameters));
+          }
+          else
+          {
+            strcpy(transferPath, path);
+            hashCommand = command[0];
+            hashPos = start;
+            hashEnd = end;
+            hasher.begin();
+            transferStatus = tHash;
+          }
+        }
+      }
+    }
+  }
   //
   //  SIZE - Size of the file
   //
@@ -809,6 +1450,15 @@ boolean FtpServer::processCommand()
       client.println("501 No file name");
     else if (makePath(path))
     {
+      FtpVirtualFile *vf = virtualFiles.find(path);
+      if (vf != NULL)
+      {
+        if (vf->size == NULL)
+          client.println("550 Size of " + String(parameters) + " unknown");
+        else
+          client.println("213 " + String(vf->getSize()));
+        return true;
+      }
       file = FTP_FS.open(path, "r");
       if (!file)
         client.println("450 Can't open " + String(parameters));
@@ -825,7 +1475,7 @@ boolean FtpServer::processCommand()
   else if (!strcmp(command, "SITE"))
   {
     FTPdebug("cmnd = %s %s\n", command, parameters);
-    client.println("500 Unknow SITE command " + String(parameters));
+    processSiteCommand();
   }
   //
   //  Unrecognized commands ...
@@ -836,121 +1486,1567 @@ boolean FtpServer::processCommand()
   return true;
 }
 
-boolean FtpServer::dataConnect()
+// Split the next argument from a list of arguments, that can be quoted
+//
+//  p : points to the arguments, moved to the following ones
+//
+//  return:
+//    the argument, "" if there is none
+
+static char *splitParam(char *&p)
 {
-  unsigned long startTime = millis();
-  //wait 5 seconds for a data connection
-  if (!data.connected())
+  while (*p == ' ')
+    p++;
+  char *arg = p;
+  if (*p == '"')
   {
-    FTPdebug("data non connecté\n");
-    while (!dataServer.hasClient() && (millis() - startTime < 5000))
-    {
-      yield();
-    }
-    if (dataServer.hasClient())
-    {
-      FTPdebug("ftpdataserver client.... %dms\n", millis() - startTime);
-      data.stop();
-      data = dataServer.accept();
-      return true;   // osé ?? !!
-    }
-    else
-    {
-      FTPdebug("time out après 5s\n");
-      return false;
-    }
-    //return data.connected();
+    arg = ++p;
+    while (*p != 0 && *p != '"')
+      p++;
   }
   else
-  {
-    FTPdebug("TRUE\n");
-    return true;
-  }
+    while (*p != 0 && *p != ' ')
+      p++;
+  if (*p != 0)
+    *p++ = 0;
+  return arg;
 }
 
-boolean FtpServer::doRetrieve()
+// SITE commands
+//
+//  parameters is "<site command> [<arguments>]"
+
+void FtpServer::processSiteCommand()
 {
-  if (data.connected())
+  char *args = strchr(parameters, ' ');
+  if (args != NULL)
+    *args++ = 0;
+  else
+    args = parameters + strlen(parameters);
+  while (*args == ' ')
+    args++;
+
+  //
+  //  SITE DF - Space of the file system
+  //
+  if (!strcasecmp(parameters, "DF"))
   {
-    int16_t nb = file.readBytes(buf, FTP_BUF_SIZE);
-    if (nb > 0)
-    {
-      FTPdebug("data envoyées %d\n", nb);
-      data.write((uint8_t *)buf, nb);
-      bytesTransfered += nb;
-      return true;
-    }
+    uint32_t total, used;
+    uint32_t avail = freeSpace(&total, &used);
+    client.println("200 Total " + String(total) + " bytes, used " + String(used) + ", available " + String(avail));
   }
-  closeTransfer();   // pas de connexion ou fin du fichier
-  return false;
-}
-
-boolean FtpServer::doStore()
-{
-  // Avoid blocking by never reading more bytes than are available
-  int navail = data.available();
-  FTPdebug("data disponibles %d\n", navail);
-  if (navail > 0)
+  //
+  //  SITE RATE - Bandwidth limits in kB/s, 0 for no limit
+  //    SITE RATE                          show the limits
+  //    SITE RATE <down> <up>              limits of this session
+  //    SITE RATE GLOBAL <down> <up>       limits shared by all sessions
+  //
+  else if (!strcasecmp(parameters, "RATE"))
   {
-    //FTPdebug("data disponibles %d\n", navail);
-    // And be sure not to overflow buf.
-    if (navail > FTP_BUF_SIZE)
-    {
-      navail = FTP_BUF_SIZE;
-    }
-    int16_t nb = data.read((uint8_t *)buf, navail);
-    FTPdebug("data lues %d\n", nb);
-    // int16_t nb = data.readBytes((uint8_t*) buf, FTP_BUF_SIZE );
-    if (nb > 0)
+    boolean global = !strncasecmp(args, "GLOBAL", 6);
+    if (global)
+      args += 6;
+    char *p;
+    uint32_t down = strtoul(args, &p, 10);
+    uint32_t up = strtoul(p, &p, 10);
+    if (*args == 0 && !global)
+      client.println("200 Rate limits (kB/s, 0 = none): session down " + String(rateDown.getRate() / 1000) +
+                     " up " + String(rateUp.getRate() / 1000) + ", global down " +
+                     String(globalRateDown.getRate() / 1000) + " up " + String(globalRateUp.getRate() / 1000));
+    else if (p == args || *p != 0)
+      client.println("501 Syntax: SITE RATE [GLOBAL] <down kB/s> <up kB/s>");
+    else
     {
-      // Serial.println( millis() << " " << nb << endl;
-      file.write((uint8_t *)buf, nb);
-      FTPdebug("data ecrites %d\n", nb);
-      bytesTransfered += nb;
+      if (global)
+        setGlobalRateLimit(down * 1000, up * 1000);
+      else
+        setRateLimit(down * 1000, up * 1000);
+      client.println("200 Rate limits set");
     }
   }
-  if (!data.connected() && (navail <= 0) && (millis() - millisBeginTrans > 100))
+  //
+  //  SITE CACHE - Statistics of the file cache
+  //
+  else if (!strcasecmp(parameters, "CACHE"))
   {
-    FTPdebug("fermeture du transfert\n");
-    closeTransfer();
-    return false;
+    client.println("200 Cache " + String(cache.getUsed()) + "/" + String(cache.getSize()) + " bytes, " +
+                   String(cache.hits) + " hits, " + String(cache.misses) + " misses");
   }
-  else
+  //
+  //  SITE CPY - Server side copy, "SITE CPY <source> <destination>"
+  //
+  //  A directory is copied with everything below it. The copy goes on
+  //  in doCopy(), a buffer per call of handleFTP(), with "250-" progress
+  //  lines every FTP_PROGRESS_MS; names with spaces must be quoted. An
+  //  entry whose copy would have a path longer than FTP_CWD_SIZE is
+  //  skipped, with a "250-" line.
+  //
+  else if (!strcasecmp(parameters, "CPY"))
   {
-    FTPdebug("transfert en cours\n");
-    return true;
+    char *src = splitParam(args);
+    char *dst = splitParam(args);
+    if (*src == 0 || *dst == 0)
+      client.println("501 Syntax: SITE CPY <source> <destination>");
+    else if (transferStatus != tIdle)
+      client.println("450 Transfer in progress, try again later");
+    else if (startCopy(src, dst))
+      transferStatus = tCopy;
   }
-}
-
-void FtpServer::closeTransfer()
-{
-  uint32_t deltaT = (int32_t)(millis() - millisBeginTrans);
-  if (deltaT > 0 && bytesTransfered > 0)
+  //
+  //  SITE PROF - Totals of an FTP_PROFILE build, "SITE PROF [RESET]"
+  //
+  //  one line per command verb, and per transfer ("+RETR": the calls of
+  //  handleFTP() that moved the data of RETR), see FtpProfile.h
+  //
+  else if (!strcasecmp(parameters, "PROF"))
   {
-    client.println("226-File successfully transferred");
-    client.println("226 " + String(deltaT) + " ms, " + String(bytesTransfered / deltaT) + " kbytes/s");
-    FTPdebug("Transfert terminé : %d bytes transférés\n", bytesTransfered);
+    if (!FTP_PROFILE)
+      client.println("502 Built without FTP_PROFILE");
+    else if (!strcasecmp(args, "RESET"))
+    {
+      FtpProfile::reset();
+      client.println("200 Profile cleared");
+    }
+    else if (*args != 0)
+      client.println("501 Syntax: SITE PROF [RESET]");
+    else
+    {
+      client.println("200-name calls allocs bytes us/call");
+      // not in buf: it may be the buffer of a transfer, or hold the path of RNFR
+      char line[80];
+      const FtpProfileEntry *e;
+      for (uint8_t i = 0; (e = FtpProfile::entry(i)) != NULL; i++)
+      {
+        snprintf(line, sizeof(line), "200-%-5s %lu %lu %lu %lu", e->name, (unsigned long)e->calls,
+                 (unsigned long)e->allocs, (unsigned long)e->bytes, (unsigned long)(e->us / e->calls));
+        client.println(line);
+      }
+      client.println("200 " + String(FtpProfile::allocs) + " allocations of " + String(FtpProfile::allocBytes) +
+                     " bytes since boot");
+    }
   }
-  else
+  //
+  //  SITE RMTREE - Remove a directory and everything below it
+  //
+  //  The tree is walked in doRemoveTree(), as many entries per call of
+  //  handleFTP() as FTP_CHUNK_BUDGET_US allows, with "250-" progress
+  //  lines every FTP_PROGRESS_MS.
+  //
+  else if (!strcasecmp(parameters, "RMTREE"))
   {
-    FTPdebug("Transfert terminé avec succès\n");
-    client.println("226 File successfully transferred");
+    char *name = splitParam(args);
+    uint32_t size;
+    time_t mtime;
+    boolean isDir;
+    if (*name == 0)
+      client.println("501 Syntax: SITE RMTREE <directory>");
+    else if (transferStatus != tIdle)
+      client.println("450 Transfer in progress, try again later");
+    else if (makePath(transferPath, name))
+    {
+      if (!strcmp(transferPath, "/"))
+        client.println("550 Can't remove the root directory");
+      else if (!FtpDirIterator::stat(transferPath, &size, &mtime, &isDir) || !isDir)
+        client.println("550 Directory " + String(name) + " not found");
+      else if (!dirIter.open(transferPath, true))
+        client.println("550 Can't read " + String(name));
+      else
+      {
+        FTPdebug("suppression de l'arborescence %s\n", transferPath);
+        removedFiles = 0;
+        removedDirs = 0;
+        removedSome = false;
+        millisBeginTrans = FTP_MILLIS();
+        millisProgress = millisBeginTrans + FTP_PROGRESS_MS;
+        transferStatus = tRmtree;
+      }
+    }
   }
-
-  file.close();
+  //
+  //  SITE SIGS - Block signatures of a file, "SITE SIGS <file> [<block size>]"
+  //
+  //  sent on the data connection, see FtpDelta.h
+  //
+  else if (!strcasecmp(parameters, "SIGS"))
+  {
+    char *name = splitParam(args);
+    char *p;
+    uint32_t bs = *args ? strtoul(args, &p, 10) : FTP_DELTA_BLOCK;
+    char path[FTP_CWD_SIZE];
+    if (*name == 0 || (*args && *p != 0) || bs < 64 || bs > 32768)
+      client.println("501 Syntax: SITE SIGS <file> [<block size 64-32768>]");
+    else if (transferStatus != tIdle)
+      client.println("450 Transfer in progress, try again later");
+    else if (makePath(path, name))
+    {
+      file = FTP_FS.open(path, "r");
+      if (!file || file.isDirectory())
+      {
+        file.close();
+        client.println("550 File " + String(name) + " not found");
+      }
+      else if (!dataConnect())
+      {
+        file.close();
+        client.println("425 No data connection");
+      }
+      else
+      {
+        sigBlock = bs;
+        hashPos = 0;
+        hashEnd = file.size();
+        client.println("150 Signatures of " + String((hashEnd + bs - 1) / bs) + " blocks");
+        millisBeginTrans = FTP_MILLIS();
+        bytesTransfered = 0;
+        transferStatus = tSigs;
+      }
+    }
+  }
+  //
+  //  SITE DELTA - Next STOR is a delta, "SITE DELTA [<block size>]"
+  //
+  else if (!strcasecmp(parameters, "DELTA"))
+  {
+    char *p;
+    uint32_t bs = *args ? strtoul(args, &p, 10) : FTP_DELTA_BLOCK;
+    if ((*args && *p != 0) || bs < 64 || bs > 32768)
+      client.println("501 Syntax: SITE DELTA [<block size 64-32768>]");
+    else
+    {
+      deltaBlock = bs;
+      client.println("200 Next STOR is a delta on blocks of " + String(bs) + " bytes");
+    }
+  }
+  //
+  //  SITE OTA - SHA-256 the next firmware must have, "SITE OTA <sha256 in hexadecimal>"
+  //
+  //  checked before the firmware sent to FTP_OTA_PATH is made the boot one
+  //
+  else if (!strcasecmp(parameters, "OTA"))
+  {
+    uint8_t i = 0;
+    for (; i < 32 && isxdigit(args[2 * i]) && isxdigit(args[2 * i + 1]); i++)
+    {
+      char hex[3] = {args[2 * i], args[2 * i + 1], 0};
+      otaSha[i] = strtoul(hex, NULL, 16);
+    }
+    if (!FTP_OTA)
+      client.println("502 No OTA in this build");
+    else if (i < 32 || args[64] != 0)
+      client.println("501 Syntax: SITE OTA <sha256>");
+    else
+    {
+      otaCheck = true;
+      client.println("200 Next firmware will be checked");
+    }
+  }
+  //
+  //  SITE DEDUP - Store a file without sending it, "SITE DEDUP <sha256> <size> <file>"
+  //
+  //  250 if <file> already has this content. If another file has it, it
+  //  is copied to <file> as by SITE CPY. Else 550: send it with STOR.
+  //
+  else if (!strcasecmp(parameters, "DEDUP"))
+  {
+    uint8_t sha[32];
+    char *hex = splitParam(args);
+    char *size = splitParam(args);
+    char *name = splitParam(args);
+    char *p;
+    uint32_t fsize = strtoul(size, &p, 10);
+    uint8_t i = 0;
+    for (; i < 32 && isxdigit(hex[2 * i]) && isxdigit(hex[2 * i + 1]); i++)
+    {
+      char h[3] = {hex[2 * i], hex[2 * i + 1], 0};
+      sha[i] = strtoul(h, NULL, 16);
+    }
+    char path[FTP_CWD_SIZE], source[FTP_CWD_SIZE];
+    FtpDigest digest;
+    if (!FTP_DEDUP)
+      client.println("502 No DEDUP in this build");
+    else if (i < 32 || hex[64] != 0 || *size == 0 || *p != 0 || *name == 0 || *args != 0)
+      client.println("501 Syntax: SITE DEDUP <sha256> <size> <file>");
+    else if (transferStatus != tIdle)
+      client.println("450 Transfer in progress, try again later");
+    else if (makePath(path, name))
+    {
+      if (virtualFiles.find(path) != NULL)
+        client.println("550 " + String(name) + " is read only");
+      else if (digest.load(path) && digest.size == fsize && !memcmp(digest.sha, sha, 32))
+        client.println("250 " + String(name) + " already holds this content");
+      else if (!FtpDedup::find(source, sha, fsize))
+        client.println("550 No file with this content, send it");
+      else
+      {
+        FTPdebug("%s copié depuis %s\n", path, source);
+        if (startCopy(source, name))
+        {
+          client.println("250-Same content as " + String(source));
+          transferStatus = tCopy;
+        }
+      }
+    }
+  }
+  //
+  //  Unrecognized SITE commands ...
+  //
+  else
+    client.println("500 Unknow SITE command " + String(parameters));
+}
+
+// Address given by PORT or EPRT: the data connections of the next
+// transfers are opened by the server
+void FtpServer::activeMode()
+{
+  if (tlsRequired && !protPrivate)
+    client.println("521 Data connections must be protected, send PROT P");
+  else if (epsvAll)
+    client.println("503 Only EPSV after EPSV ALL");
+  // no connection to a third party (FTP bounce, RFC 2577)
+  else if ((uint32_t)dataIp != (uint32_t)client.remoteIP() || dataPort < 1024)
+    client.println("504 Data connection only to " + client.remoteIP().toString() + ", port 1024 or above");
+  else
+  {
+    client.println("200 " + String(command) + " command successful");
+    dataPassiveConn = false;
+  }
+}
+
+// Start the data connection of a transfer: accepted on dataServer in
+// passive mode, opened to dataIp:dataPort in active mode. The command
+// replies 150 at once, the transfer then waits in handleFTP() for
+// dataOpen() instead of blocking loop().
+//
+//  return false if the connection can't even be started
+boolean FtpServer::dataConnect()
+{
+  dataWaiting = false;
+  transferTask = 0; // the transfer it opens starts from the top
+  sendLeft = 0;
+  if (data.connected())
+  {
+    FTPdebug("TRUE\n");
+    return true;
+  }
+  FTPdebug("data non connecté\n");
+  millisData = FTP_MILLIS();
+  if (!dataPassiveConn && !data.connectStart(dataIp, dataPort))
+    return false;
+  dataWaiting = true;
+  return dataOpen() >= 0;
+}
+
+// Next step of the opening of the data connection
+//
+//  return:
+//    -1 if it failed or took more than FTP_DATA_TIMEOUT
+//     0 if not open yet
+//     1 when open
+int8_t FtpServer::dataOpen()
+{
+  if (dataPassiveConn)
+  {
+    if (!dataServer.hasClient())
+    {
+      if (FTP_MILLIS() - millisData < FTP_DATA_TIMEOUT)
+        return 0;
+      FTPdebug("time out après %d ms\n", FTP_DATA_TIMEOUT);
+      dataWaiting = false;
+      return -1;
+    }
+    FTPdebug("ftpdataserver client.... %lums\n", (unsigned long)(FTP_MILLIS() - millisData));
+    data.stop();
+    data = dataServer.accept();
+  }
+  else
+  {
+    int8_t rc = data.connecting();
+    if (rc == 0)
+      return 0;
+    if (rc < 0)
+    {
+      dataWaiting = false;
+      return -1;
+    }
+  }
+  dataWaiting = false;
+  // with PROT P, handleFTP() negotiates TLS once the 150 reply is sent
+  if (protPrivate && !data.startTls(tls))
+  {
+    data.stop();
+    return -1;
+  }
+  return 1;
+}
+
+// The data side of a command, from the opening of its data connection to
+// the end of its job. A task (see FtpTask.h): it returns to loop() at each
+// wait and handleFTP() calls it again until it is over.
+//
+//  return true while it runs
+boolean FtpServer::runTransfer()
+{
+  FTP_TASK_BEGIN(transferTask);
+  // the data connection, still opening after the 150 reply
+  transferRc = 1;
+  FTP_TASK_WAIT_UNTIL(transferTask, !dataWaiting || (transferRc = dataOpen()) != 0);
+  if (transferRc < 0)
+  {
+    abortTransfer("425 No data connection");
+    FTP_TASK_EXIT(transferTask);
+  }
+  // then its TLS session, with PROT P
+  FTP_TASK_WAIT_UNTIL(transferTask, !data.handshaking() || (transferRc = data.handshake()) != 0);
+  if (transferRc < 0)
+  {
+    abortTransfer();
+    FTP_TASK_EXIT(transferTask);
+  }
+  while (transferStep())
+  {
+    while (sendLeft > 0)
+    {
+      FTP_TASK_WAIT_UNTIL(transferTask, data.availableForWrite() > 0 || !data.connected());
+      sendPending();
+    }
+    FTP_TASK_YIELD(transferTask);
+  }
+  transferStatus = tIdle;
+  FTP_TASK_END(transferTask);
+}
+
+// Count this server in transfersRunning while it has a job
+void FtpServer::countTransfer()
+{
+  boolean running = transferStatus != tIdle;
+  if (running == transferCounted)
+    return;
+  transferCounted = running;
+  if (running)
+    transfersRunning++;
+  else
+    transfersRunning--;
+}
+
+// One step of the job of transferStatus
+//
+//  return false once the job is over
+boolean FtpServer::transferStep()
+{
+  switch (transferStatus)
+  {
+  case tRetrieve: // Retrieve data
+  case tStore: // Store data
+    if (transferStatus == tRetrieve ? doRetrieve() : doStore())
+      return true;
+    logTransfer();
+    endChunks();
+    return false;
+  case tList: // Directory listing
+    return doList();
+  case tHash: // Digest of a file (HASH, XCRC)
+    return doHash();
+  case tCopy: // Server side copy (SITE CPY)
+    return doCopy();
+  case tSigs: // Block signatures (SITE SIGS)
+    return doSignatures();
+  case tRmtree: // Recursive delete (SITE RMTREE)
+    return doRemoveTree();
+  default:
+    return false;
+  }
+}
+
+// Write what the send buffer takes of the chunk left by doRetrieve()
+void FtpServer::sendPending()
+{
+  if (!data.connected())
+  {
+    sendLeft = 0;
+    return;
+  }
+  int room = data.availableForWrite();
+  if (room <= 0)
+    return;
+  size_t n = data.write(sendPtr, sendLeft < room ? sendLeft : room);
+  sendPtr += n;
+  sendLeft -= n;
+}
+
+boolean FtpServer::doRetrieve()
+{
+  if (data.connected())
+  {
+    // TYPE A leaves room in the buffer for the CRs that toCrlf() adds
+    uint32_t wanted = chunkSize;
+    if (asciiTransfer && wanted > (uint32_t)xferBufSize - asciiRoom)
+      wanted = xferBufSize - asciiRoom;
+    uint32_t allowed = rateAllowance(rateDown, globalRateDown, wanted);
+    if (allowed == 0)
+      return true; // bandwidth used up, wait for the next call
+    uint32_t start = FTP_MICROS();
+    // at the end of the buffer with TYPE A, toCrlf() writes from its start
+    uint8_t *chunk = (uint8_t *)xferBuf + (asciiTransfer ? xferBufSize - allowed : 0);
+    int16_t nb;
+    if (cacheEntry != NULL && cacheEntry->ready)
+    {
+      // served from the cache
+      uint32_t left = cacheEntry->size - transferOffset - bytesTransfered;
+      nb = left < allowed ? left : allowed;
+      chunk = cacheEntry->data + transferOffset + bytesTransfered;
+    }
+    else if (virtualFile != NULL)
+    {
+      // removeVirtualFile() clears read while it is served
+      nb = virtualFile->read != NULL ? virtualFile->read(transferOffset + bytesTransfered, chunk, allowed, virtualFile->arg) : 0;
+    }
+    else
+    {
+      nb = file.readBytes((char *)chunk, allowed);
+      if (cacheEntry != NULL && nb > 0 && bytesTransfered + nb <= cacheEntry->size)
+        memcpy(cacheEntry->data + bytesTransfered, chunk, nb);
+    }
+    if (nb > 0)
+    {
+      uint16_t used = nb; // bytes of the file sent by this call
+      if (asciiTransfer)
+      {
+        // The lines whose CRs don't fit are read again by the next call,
+        // which leaves more room. The cache and the virtual files are
+        // read at bytesTransfered, only a file must go back.
+        size_t crs;
+        used = FtpAscii::fitCrlf(chunk, nb, asciiCR, xferBufSize - allowed, crs) - chunk;
+        if (used < nb)
+        {
+          asciiRoom = asciiRoom < xferBufSize / 4 ? asciiRoom * 2 : xferBufSize / 2;
+          if (cacheEntry == NULL && virtualFile == NULL)
+            file.seek(transferOffset + bytesTransfered + used);
+        }
+        else
+          asciiRoom = crs + crs / 4 + FTP_CHUNK_MIN / 8;
+      }
+      // digests and cache are those of the file, the wire may have more
+      if (hashTransfer)
+        hasher.update(chunk, used);
+      uint16_t len = used;
+      if (asciiTransfer)
+      {
+        len = FtpAscii::toCrlf((uint8_t *)xferBuf, chunk, used, asciiCR);
+        chunk = (uint8_t *)xferBuf;
+      }
+      FTPdebug("data envoyées %d\n", len);
+#if FTP_WRITE_WAIT
+      // the rest is written by runTransfer() as the send buffer empties
+      sendPtr = chunk;
+      sendLeft = len;
+      sendPending();
+#else
+      data.write(chunk, len);
+#endif
+      rateDown.consume(len);
+      globalRateDown.consume(len);
+      bytesTransfered += used;
+      adaptChunk(FTP_MICROS() - start, (uint32_t)nb == wanted);
+      return true;
+    }
+  }
+  closeTransfer();   // pas de connexion ou fin du fichier
+  return false;
+}
+
+boolean FtpServer::doStore()
+{
+  // A segment beyond the end of the file: fill the gap first, a buffer per
+  // call. The data written by the other segments is always below the end.
+  if (segment != NULL && transferSize == 0 && segment->size() < transferOffset)
+  {
+    uint32_t gap = transferOffset - segment->size();
+    uint16_t n = gap < FTP_BUF_SIZE ? gap : FTP_BUF_SIZE;
+    memset(buf, 0, n);
+    if (segment->seek(0, SeekEnd) && segment->write((uint8_t *)buf, n) == n)
+      return true;
+    sharedFiles.release(segment);
+    segment = NULL;
+    data.stop();
+    client.println("452 Insufficient storage space, transfer aborted");
+    return false;
+  }
+  // Avoid blocking by never reading more bytes than are available
+  int navail = data.available();
+  FTPdebug("data disponibles %d\n", navail);
+  if (navail > 0 || delta.copying())
+  {
+    //FTPdebug("data disponibles %d\n", navail);
+    // And be sure not to overflow buf.
+    uint32_t start = FTP_MICROS();
+    boolean full = navail >= chunkSize;
+    if (navail > chunkSize)
+    {
+      navail = chunkSize;
+    }
+    uint32_t allowed = navail > 0 ? rateAllowance(rateUp, globalRateUp, navail) : 0;
+    if (allowed == 0 && !delta.copying())
+      return true; // bandwidth used up, leave the data in the socket
+    int32_t nb;
+    uint32_t received;
+    if (asciiTransfer)
+    {
+      // one byte ahead, for the CR held back by the previous chunk
+      if (allowed > (uint32_t)xferBufSize - 1)
+        allowed = xferBufSize - 1;
+      received = data.read((uint8_t *)xferBuf + 1, allowed);
+      nb = FtpAscii::fromCrlf((uint8_t *)xferBuf, (uint8_t *)xferBuf + 1, received, asciiCR);
+    }
+    else if (deltaBlock == 0)
+      received = nb = data.read((uint8_t *)xferBuf, allowed);
+    else
+    {
+      nb = delta.step(data, allowed, (uint8_t *)xferBuf, xferBufSize);
+      received = delta.lastRead();
+      if (nb < 0)
+      {
+        file.close();
+        FTP_FS.remove(transferPath);
+        delta.end();
+        deltaBlock = 0;
+        data.stop();
+        hashTransfer = false;
+        client.println("451 Invalid delta stream, transfer aborted");
+        return false;
+      }
+    }
+    FTPdebug("data lues %d\n", nb);
+    // int16_t nb = data.readBytes((uint8_t*) buf, FTP_BUF_SIZE );
+    if (received > 0)
+    {
+      rateUp.consume(received);
+      globalRateUp.consume(received);
+      bytesTransfered += received;
+    }
+    if (nb > 0)
+    {
+      // Serial.println( millis() << " " << nb << endl;
+      if (otaStore && otaWrite((uint8_t *)xferBuf, nb) < (size_t)nb)
+      {
+        FTPdebug("écriture du firmware impossible\n");
+        String error = otaError();
+        otaAbort();
+        otaStore = false;
+        data.stop();
+        hashTransfer = false;
+        client.println("451 OTA: " + error + ", update cancelled");
+        return false;
+      }
+      if (!otaStore && storeWrite((uint8_t *)xferBuf, nb) < (size_t)nb)
+      {
+        // File system full: stop now rather than after the whole upload
+        FTPdebug("écriture incomplète, système de fichiers plein\n");
+        if (segment != NULL)
+        {
+          // the other segments go on, the client retries this one
+          sharedFiles.release(segment);
+          segment = NULL;
+        }
+        else
+        {
+          file.close();
+          FTP_FS.remove(transferPath);
+        }
+        if (deltaBlock > 0)
+        {
+          delta.end();
+          deltaBlock = 0;
+        }
+        data.stop();
+        hashTransfer = false;
+        client.println("452 Insufficient storage space, transfer aborted");
+        return false;
+      }
+      if (hashTransfer)
+        hasher.update((uint8_t *)xferBuf, nb);
+      FTPdebug("data ecrites %d\n", nb);
+      transferSize += nb;
+    }
+    if (deltaBlock == 0 && received > 0)
+      adaptChunk(FTP_MICROS() - start, full);
+  }
+  if (!data.connected() && (navail <= 0) && !delta.copying() && (FTP_MILLIS() - millisBeginTrans > 100))
+  {
+    FTPdebug("fermeture du transfert\n");
+    if (asciiTransfer && asciiCR)
+    {
+      // the upload ended with a CR, kept as is
+      asciiCR = false;
+      if (storeWrite((const uint8_t *)"\r", 1) == 1)
+      {
+        if (hashTransfer)
+          hasher.update((const uint8_t *)"\r", 1);
+        transferSize++;
+      }
+    }
+    if (otaStore)
+    {
+      // the new firmware only becomes the boot one if its digest is right
+      FtpDigest digest;
+      char hex[65];
+      hasher.finish(digest);
+      FtpDigest::toHex(hex, digest.sha, 32);
+      boolean match = !otaCheck || !memcmp(digest.sha, otaSha, 32);
+      otaStore = false;
+      otaCheck = false;
+      hashTransfer = false;
+      if (!match)
+        otaAbort();
+      if (!match || !otaEnd())
+      {
+        data.stop();
+        client.println(match ? "451 OTA: " + otaError() + ", update cancelled"
+                             : "451 Firmware SHA-256 " + String(hex) + " does not match, update cancelled");
+        return false;
+      }
+      otaDone = true;
+      client.println("226-Firmware of " + String(transferSize) + " bytes written, SHA-256 " + String(hex));
+      client.println("226-Restart to run it");
+    }
+    if (deltaBlock > 0)
+    {
+      // replace the old file by the one rebuilt aside
+      boolean complete = delta.betweenInstructions();
+      delta.end();
+      deltaBlock = 0;
+      file.close();
+      char *ext = transferPath + strlen(transferPath) - strlen(FTP_DELTA_EXT);
+      char tmpPath[FTP_CWD_SIZE];
+      strcpy(tmpPath, transferPath);
+      *ext = 0;
+      if (!complete || !FTP_FS.remove(transferPath) || !FTP_FS.rename(tmpPath, transferPath))
+      {
+        FTP_FS.remove(tmpPath);
+        data.stop();
+        hashTransfer = false;
+        client.println("451 Delta stream incomplete, " + String(transferPath) + " unchanged");
+        return false;
+      }
+      client.println("226-" + String(transferSize) + " bytes rebuilt from " + String(bytesTransfered) + " bytes received");
+    }
+    closeTransfer();
+    return false;
+  }
+  else
+  {
+    FTPdebug("transfert en cours\n");
+    return true;
+  }
+}
+
+// Send the next part of a LIST, MLSD or NLST listing
+//
+//  fill buf with as many entries as the data socket can take without
+//  blocking and write it in one go, like doRetrieve() does for a file
+//
+//  return:
+//    false when the listing is complete or the data connection is lost
+
+boolean FtpServer::doList()
+{
+  // STAT <path> answers on the control connection
+  FtpConnection &out = listStat ? client : data;
+  if (!out.connected())
+  {
+    dirIter.close();
+    virtualFile = NULL;
+    client.println("426 Data connection lost");
+    return false;
+  }
+
+  uint16_t room = FTP_BUF_SIZE;
+#if FTP_WRITE_WAIT
+  int writable = out.availableForWrite();
+  if (writable < room)
+    room = writable;
+#endif
+  uint16_t len = 0;
+  boolean done = false;
+  while (true)
+  {
+    if (!listPending)
+    {
+      if (dirIter.next())
+      {
+        if (FtpDigest::isSideFile(dirIter.name()) ||
+            (FTP_DEDUP && FtpDedup::inIndex(transferPath, dirIter.relName())))
+          continue;
+      }
+      else if ((virtualFile = virtualFiles.next(transferPath, listRecursive, listVirtual, &listName)) == NULL)
+      {
+        done = true;
+        break;
+      }
+      else if (listFiltered)
+      {
+        const char *base = strrchr(listName, '/');
+        if (!listGlob.match(base != NULL ? base + 1 : listName))
+          continue;
+      }
+      listPending = true;
+    }
+    int16_t nb = formatListEntry(buf + len, room - len);
+    if (nb < 0)
+      break; // keep this entry for the next call
+    len += nb;
+    listCount++;
+    listPending = false;
+  }
+  if (len > 0)
+  {
+    out.write((uint8_t *)buf, len);
+    bytesTransfered += len;
+  }
+  if (!done)
+    return true;
+
+  FTPdebug("Listing terminé : %d entrées\n", listCount);
+  dirIter.close();
+  virtualFile = NULL;
+  if (listStat)
+  {
+    client.println("213 End of status, " + String(listCount) + " matches total");
+    return false;
+  }
+  data.stop();
+  if (listCommand == 'M')
+    client.println("226-options: -a -l");
+  client.println("226 " + String(listCount) + " matches total");
+  return false;
+}
+
+// Format the current entry of dirIter for the listing in progress
+//
+//  LIST : EPLF, "+r,s<size>,m<time>,\t<name>" or "+/,m<time>,\t<name>",
+//         without s<size> for a virtual file of unknown size
+//  MLSD : RFC 3659 facts, see formatFacts()
+//  NLST : "<name>"
+//
+//  in a recursive listing, <name> is the path relative to the listed directory.
+//  Once dirIter is done, the entry is virtualFile, modified now.
+//
+//  return:
+//    length of the line written to line, or -1 if it does not fit in size
+
+int16_t FtpServer::formatListEntry(char *line, uint16_t size)
+{
+  const char *name = dirIter.relName();
+  uint32_t fsize = dirIter.size();
+  time_t mtime = dirIter.modified();
+  boolean isDir = dirIter.isDirectory();
+  boolean sizeKnown = true;
+  if (virtualFile != NULL)
+  {
+    name = listName;
+    fsize = virtualFile->getSize();
+    sizeKnown = virtualFile->size != NULL;
+    mtime = time(NULL);
+    isDir = false;
+  }
+
+  int nb;
+  if (listCommand == 'N')
+    nb = snprintf(line, size, "%s\r\n", name);
+  else if (listCommand == 'L')
+  {
+    if (isDir)
+      nb = snprintf(line, size, "+/,m%lu,\t%s\r\n", (unsigned long)mtime, name);
+    else if (!sizeKnown)
+      nb = snprintf(line, size, "+r,m%lu,\t%s\r\n", (unsigned long)mtime, name);
+    else
+      nb = snprintf(line, size, "+r,s%lu,m%lu,\t%s\r\n", (unsigned long)fsize, (unsigned long)mtime, name);
+  }
+  else
+    nb = formatFacts(line, size, fsize, mtime, isDir, name, virtualFile != NULL, sizeKnown);
+  if (nb < 0 || nb >= size)
+    return -1;
+  return nb;
+}
+
+// Format the RFC 3659 facts of an entry, as sent by MLSD and MLST
+//
+//  "type=file;size=<size>;modify=<YYYYMMDDHHMMSS>;perm=rwdf; <name>"
+//  "type=dir;modify=<YYYYMMDDHHMMSS>;perm=elcf; <name>"
+//  a read only (virtual) file only has perm=r, and no size if it is unknown
+//
+//  return:
+//    value of snprintf() for the line
+
+int FtpServer::formatFacts(char *line, uint16_t size, uint32_t fsize, time_t mtime,
+                           boolean isDir, const char *name, boolean readOnly, boolean sizeKnown)
+{
+  tm tm_gmt;
+  char strftime_buf[15];
+  gmtime_r(&mtime, &tm_gmt);
+  strftime(strftime_buf, sizeof(strftime_buf), "%Y%m%d%H%M%S", &tm_gmt);
+  if (isDir)
+    return snprintf(line, size, "type=dir;modify=%s;perm=elcf; %s\r\n", strftime_buf, name);
+  if (!sizeKnown)
+    return snprintf(line, size, "type=file;modify=%s;perm=%s; %s\r\n", strftime_buf, readOnly ? "r" : "rwdf", name);
+  return snprintf(line, size, "type=file;size=%lu;modify=%s;perm=%s; %s\r\n",
+                  (unsigned long)fsize, strftime_buf, readOnly ? "r" : "rwdf", name);
+}
+
+// Compute the digests of a file for HASH or XCRC, a buffer at a time
+//
+//  reads transferPath from hashPos to hashEnd, then answers the command
+//
+//  return:
+//    false when the command has been answered
+
+boolean FtpServer::doHash()
+{
+  uint32_t left = hashEnd - hashPos;
+  if (left > 0)
+  {
+    int16_t nb = file.readBytes(buf, left < FTP_BUF_SIZE ? left : FTP_BUF_SIZE);
+    if (nb > 0)
+    {
+      hasher.update((uint8_t *)buf, nb);
+      hashPos += nb;
+      if (hashPos < hashEnd)
+        return true;
+    }
+  }
+  uint32_t fsize = file.size();
+  file.close();
+
+  FtpDigest digest;
+  hasher.finish(digest);
+  if (hashPos != hashEnd)
+  {
+    client.println("451 Read error");
+    return false;
+  }
+  if (digest.size == fsize) // whole file
+    digest.save(transferPath);
+  hashReply(digest, hashCommand, transferPath, hashEnd);
+  return false;
+}
+
+// Answer HASH (H) or XCRC (X) of path with a digest of the range ending at end
+void FtpServer::hashReply(FtpDigest &digest, char cmd, const char *path, uint32_t end)
+{
+  char hex[65];
+  if (cmd == 'X')
+  {
+    sprintf(hex, "%08lX", (unsigned long)digest.crc);
+    client.println("250 " + String(hex));
+    return;
+  }
+  uint32_t start = end - digest.size;
+  uint32_t last = end > start ? end - 1 : start;
+  if (hashCrc)
+  {
+    sprintf(hex, "%08lx", (unsigned long)digest.crc);
+    client.println("213 CRC32 " + String(start) + "-" + String(last) + " " + String(hex) + " " + String(path));
+  }
+  else
+  {
+    FtpDigest::toHex(hex, digest.sha, 32);
+    client.println("213 SHA-256 " + String(start) + "-" + String(last) + " " + String(hex) + " " + String(path));
+  }
+}
+
+// Check and open a SITE CPY
+//
+//  src, dst : source and destination, as sent by the client
+//
+//  return:
+//    true if doCopy() has to go on, else the command has been answered
+
+boolean FtpServer::startCopy(char *src, char *dst)
+{
+  uint32_t srcSize, dstSize;
+  time_t mtime;
+  boolean srcIsDir, dstIsDir;
+
+  if (!makePath(transferPath, src) || !makePath(copyDst, dst))
+    return false;
+  if (!FtpDirIterator::stat(transferPath, &srcSize, &mtime, &srcIsDir))
+  {
+    client.println("550 " + String(src) + " not found");
+    return false;
+  }
+  // copy into an existing directory keeps the name of the source
+  if (FtpDirIterator::stat(copyDst, &dstSize, &mtime, &dstIsDir) && dstIsDir)
+  {
+    const char *base = strrchr(transferPath, '/') + 1;
+    if (strlen(copyDst) + strlen(base) + 2 > FTP_CWD_SIZE)
+    {
+      client.println("553 Destination name too long");
+      return false;
+    }
+    if (strcmp(copyDst, "/"))
+      strcat(copyDst, "/");
+    strcat(copyDst, base);
+  }
+  size_t n = strlen(transferPath);
+  if (!strcmp(transferPath, copyDst) ||
+      (srcIsDir && !strncmp(copyDst, transferPath, n) && copyDst[n] == '/'))
+  {
+    client.println("553 Can't copy " + String(src) + " into itself");
+    return false;
+  }
+
+  copyTree = srcIsDir;
+  copyFiles = 0;
+  copySkipped = 0;
+  hashTransfer = FTP_HASH_ON_TRANSFER || FTP_DEDUP; // as a STOR
+  bytesTransfered = 0;
+  millisBeginTrans = FTP_MILLIS();
+  millisProgress = millisBeginTrans + FTP_PROGRESS_MS;
+  if (copyTree)
+  {
+    if (!dirIter.open(transferPath, true) ||
+        (!FTP_FS.exists(copyDst) && !FTP_FS.mkdir(copyDst)))
+    {
+      dirIter.close();
+      client.println("550 Can't copy directory " + String(src));
+      return false;
+    }
+  }
+  else
+  {
+    if (srcSize > freeSpace())
+    {
+      client.println("452 Insufficient storage space");
+      return false;
+    }
+    file = FTP_FS.open(transferPath, "r");
+    copyFile = FTP_FS.open(copyDst, "w");
+    if (!file || !copyFile)
+    {
+      file.close();
+      copyFile.close();
+      client.println("550 Can't copy " + String(src));
+      return false;
+    }
+    cache.invalidate(copyDst);
+    FtpDigest::remove(copyDst);
+    if (hashTransfer)
+      hasher.begin();
+  }
+  FTPdebug("copie de %s vers %s\n", transferPath, copyDst);
+  return true;
+}
+
+// Destination of the file being copied by SITE CPY
+//
+//  return false if it is longer than FTP_CWD_SIZE
+boolean FtpServer::copyTarget(char *path)
+{
+  strcpy(path, copyDst);
+  if (!copyTree)
+    return true;
+  if (strlen(path) + strlen(dirIter.relName()) + 2 > FTP_CWD_SIZE)
+    return false;
+  strcat(path, "/");
+  strcat(path, dirIter.relName());
+  return true;
+}
+
+// Copy the next buffer of a SITE CPY, or go to the next entry of the tree
+//
+//  return:
+//    false when the command has been answered
+
+boolean FtpServer::doCopy()
+{
+  char target[FTP_CWD_SIZE];
+  if (file)
+  {
+    int16_t nb = file.readBytes(buf, FTP_BUF_SIZE);
+    if (nb > 0)
+    {
+      if (copyFile.write((uint8_t *)buf, nb) < (size_t)nb)
+      {
+        file.close();
+        copyFile.close();
+        dirIter.close();
+        copyTarget(target);
+        FTP_FS.remove(target);
+        client.println("452 Insufficient storage space, copy aborted after " + String(copyFiles) + " files");
+        return false;
+      }
+      if (hashTransfer)
+        hasher.update((uint8_t *)buf, nb);
+      bytesTransfered += nb;
+      if ((int32_t)(FTP_MILLIS() - millisProgress) >= 0)
+      {
+        client.println("250-" + String(copyFiles) + " files, " + String(bytesTransfered) + " bytes copied");
+        millisProgress = FTP_MILLIS() + FTP_PROGRESS_MS;
+      }
+      return true;
+    }
+    // end of this file
+    file.close();
+    copyFile.close();
+    copyTarget(target);
+    cache.invalidate(target); // a RETR may have cached the old content meanwhile
+    if (hashTransfer)
+    {
+      FtpDigest digest;
+      hasher.finish(digest);
+      digest.save(target);
+    }
+    copyFiles++;
+  }
+
+  // next entry of the tree: directories come before their content
+  while (copyTree && dirIter.next())
+  {
+    if (FtpDigest::isSideFile(dirIter.name()))
+      continue;
+    if (!copyTarget(target))
+    {
+      // and so is the content of a directory
+      client.println("250-" + String(dirIter.relName()) + " not copied, path too long");
+      copySkipped++;
+      continue;
+    }
+    cache.invalidate(target);
+    if (dirIter.isDirectory())
+    {
+      if (!FTP_FS.exists(target))
+        FTP_FS.mkdir(target);
+      return true;
+    }
+    String source = String(transferPath) + "/" + dirIter.relName();
+    file = FTP_FS.open(source, "r");
+    copyFile = FTP_FS.open(target, "w");
+    if (!file || !copyFile)
+    {
+      file.close();
+      copyFile.close();
+      dirIter.close();
+      client.println("451 Can't copy " + source + ", copy aborted after " + String(copyFiles) + " files");
+      return false;
+    }
+    FtpDigest::remove(target);
+    if (hashTransfer)
+      hasher.begin();
+    return true;
+  }
+
+  dirIter.close();
+  uint32_t deltaT = FTP_MILLIS() - millisBeginTrans;
+  client.println("250 " + String(copyFiles) + " files, " + String(bytesTransfered) + " bytes copied in " + String(deltaT) + " ms" +
+                 (copySkipped > 0 ? ", " + String(copySkipped) + " entries skipped" : String("")));
+  return false;
+}
+
+// Reply to STAT without argument: the session, then the transfer in progress
+void FtpServer::statusReply()
+{
+  client.println("211-Status of " + String(FTP_SERVER_VERSION));
+  client.println("211-Connected to " + clientIp.toString() + ", logged in as " + _FTP_USER);
+  client.println("211-TYPE " + String(asciiType ? "ASCII" : "binary") + ", control connection " +
+                 (client.secure() ? "TLS" : "clear") + ", data " + (protPrivate ? "TLS" : "clear") + ", " +
+                 (dataPassiveConn ? "passive" : "active"));
+  uint32_t deltaT = FTP_MILLIS() - millisBeginTrans;
+  String rate = deltaT > 0 ? ", " + String(bytesTransfered / deltaT) + " kbytes/s" : String("");
+  switch (transferStatus)
+  {
+  case tRetrieve:
+    client.println("211-Sending " + String(transferPath) + ", " + String(bytesTransfered) + " of " +
+                   String(transferSize) + " bytes" + rate);
+    break;
+  case tStore:
+    client.println("211-Receiving " + String(transferPath) + ", " + String(bytesTransfered) + " bytes" + rate);
+    break;
+  case tList:
+    client.println("211-Listing " + String(transferPath) + ", " + String(listCount) + " entries");
+    break;
+  case tHash:
+  case tSigs:
+    client.println("211-Reading " + String(transferPath) + ", " + String(hashPos) + " of " + String(hashEnd) + " bytes");
+    break;
+  default:
+    client.println("211-No transfer in progress");
+  }
+  client.println("211 End of status");
+}
+
+// Remove the next entries of a SITE RMTREE
+//
+// A directory comes before its content, so it can only be removed once a
+// later pass finds it empty. A pass removes the files and the directories
+// left empty by the previous one, the tree is gone after as many passes
+// as it has levels. A pass that removes nothing ends the command: what is
+// left is in use, or deeper than FTP_DIR_DEPTH.
+//
+//  return:
+//    false when the command has been answered
+
+boolean FtpServer::doRemoveTree()
+{
+  char path[FTP_CWD_SIZE];
+  uint32_t start = FTP_MICROS();
+  do
+  {
+    if (!dirIter.next())
+    {
+      dirIter.close();
+      uint32_t deltaT = FTP_MILLIS() - millisBeginTrans;
+      if (FTP_FS.rmdir(transferPath))
+      {
+        removedDirs++;
+        client.println("250 " + String(removedFiles) + " files and " + String(removedDirs) +
+                       " directories removed in " + String(deltaT) + " ms");
+        return false;
+      }
+      if (!removedSome || !dirIter.open(transferPath, true))
+      {
+        client.println("450 " + String(removedFiles) + " files and " + String(removedDirs) +
+                       " directories removed, the rest of " + String(transferPath) + " can't be");
+        return false;
+      }
+      removedSome = false;
+      return true;
+    }
+    if (strlen(transferPath) + strlen(dirIter.relName()) + 2 > FTP_CWD_SIZE)
+      continue;
+    strcpy(path, transferPath);
+    strcat(path, "/");
+    strcat(path, dirIter.relName());
+    if (dirIter.isDirectory())
+    {
+      // fails until its content is gone
+      if (FTP_FS.rmdir(path))
+      {
+        removedDirs++;
+        removedSome = true;
+      }
+    }
+    else if (!sharedFiles.busy(path) && FTP_FS.remove(path))
+    {
+      cache.invalidate(path);
+      if (!FtpDigest::isSideFile(dirIter.name()))
+        removedFiles++;
+      removedSome = true;
+    }
+  } while (FTP_MICROS() - start < FTP_CHUNK_BUDGET_US);
+  if ((int32_t)(FTP_MILLIS() - millisProgress) >= 0)
+  {
+    client.println("250-" + String(removedFiles) + " files and " + String(removedDirs) + " directories removed");
+    millisProgress = FTP_MILLIS() + FTP_PROGRESS_MS;
+  }
+  return true;
+}
+
+// STOR to FTP_OTA_PATH: the data go to the Update API instead of FTP_FS,
+// the size announced by ALLO, if any, is given to the updater
+void FtpServer::storeFirmware()
+{
+  uint32_t size = allocSize;
+  allocSize = 0;
+  deltaBlock = 0;
+  if (!otaBegin(size))
+  {
+    client.println("451 OTA: " + otaError());
+  }
+  else if (!dataConnect())
+  {
+    otaAbort();
+    client.println("425 No data connection");
+  }
+  else
+  {
+    FTPdebug("Réception du firmware\n");
+    client.println("150 Connected to port " + String(dataPort) + ", writing firmware");
+    strcpy(transferPath, FTP_OTA_PATH);
+    otaStore = true;
+    asciiTransfer = false; // a firmware is binary whatever the TYPE
+    hashTransfer = true;
+    hasher.begin();
+    beginChunks();
+    millisBeginTrans = FTP_MILLIS();
+    bytesTransfered = 0;
+    transferSize = 0;
+    transferStatus = tStore;
+  }
+}
+
+// Send the signatures of the blocks of the next buffer of a file
+//
+//  return:
+//    false when all the signatures have been sent
+
+boolean FtpServer::doSignatures()
+{
+  if (!data.connected())
+  {
+    file.close();
+    client.println("426 Data connection lost");
+    return false;
+  }
+  int16_t nb = hashPos < hashEnd ? file.readBytes(buf, FTP_BUF_SIZE) : 0;
+  if (nb <= 0 && hashPos < hashEnd)
+  {
+    file.close();
+    data.stop();
+    client.println("451 Read error");
+    return false;
+  }
+  String lines;
+  if (bytesTransfered == 0) // header, once the data connection is open
+    lines = String(hashEnd) + " " + String(sigBlock) + "\r\n";
+  for (int16_t i = 0; i < nb;)
+  {
+    uint16_t inBlock = hashPos % sigBlock;
+    if (inBlock == 0)
+    {
+      blockSum.begin();
+      blockSha.begin();
+    }
+    uint16_t n = sigBlock - inBlock;
+    if (n > nb - i)
+      n = nb - i;
+    blockSum.update((uint8_t *)buf + i, n);
+    blockSha.update((uint8_t *)buf + i, n);
+    i += n;
+    hashPos += n;
+    if (hashPos % sigBlock == 0 || hashPos == hashEnd)
+    {
+      uint8_t sha[32];
+      char line[48], hex[17];
+      blockSha.finish(sha);
+      FtpDigest::toHex(hex, sha, 8);
+      snprintf(line, sizeof(line), "%lu %08lx %s\r\n", (unsigned long)((hashPos - 1) / sigBlock),
+               (unsigned long)blockSum.value(), hex);
+      lines += line;
+    }
+  }
+  if (lines.length() > 0)
+  {
+    data.print(lines);
+    bytesTransfered += lines.length();
+  }
+  if (hashPos < hashEnd)
+    return true;
+  file.close();
+  closeTransfer();
+  return false;
+}
+
+// Write the next bytes received by STOR, at the offset of its segment
+// if it is one
+size_t FtpServer::storeWrite(const uint8_t *bytes, size_t len)
+{
+  if (segment == NULL)
+    return file.write(bytes, len);
+  if (!segment->seek(transferOffset + transferSize))
+    return 0;
+  return segment->write(bytes, len);
+}
+
+// Line of the transfer log for the RETR or STOR that just ended
+void FtpServer::logTransfer()
+{
+  if (!FTP_XFERLOG || (transferStatus != tRetrieve && transferStatus != tStore))
+    return;
+  char date[32], path[FTP_CWD_SIZE], line[FTP_CWD_SIZE + 128];
+  time_t now = time(NULL);
+  strftime(date, sizeof(date), "%a %b %e %H:%M:%S %Y", localtime(&now));
+  // the fields are separated by spaces
+  strcpy(path, transferPath);
+  for (char *p = path; *p != 0; p++)
+    if (*p == ' ')
+      *p = '_';
+  snprintf(line, sizeof(line), "%s %lu %s %lu %s %c _ %c r %s ftp 0 * %c\n",
+           date, (unsigned long)((FTP_MILLIS() - millisBeginTrans + 500) / 1000), clientIp.toString().c_str(),
+           (unsigned long)bytesTransfered, path, asciiTransfer ? 'a' : 'b', transferStatus == tRetrieve ? 'o' : 'i',
+           _FTP_USER.c_str(), transferComplete ? 'c' : 'i');
+  xferLog.add(line);
+  transferComplete = false;
+}
+
+#ifdef ESP8266
+static uint32_t largestFreeBlock() { return ESP.getMaxFreeBlockSize(); }
+#else
+static uint32_t largestFreeBlock() { return ESP.getMaxAllocHeap(); }
+#endif
+
+// Buffer of a RETR or STOR: up to FTP_CHUNK_MAX bytes from the heap if it
+// has room for them and FTP_CHUNK_HEAP_RESERVE more, else buf. A delta is
+// decoded a buffer at a time, always in buf.
+void FtpServer::beginChunks()
+{
+  endChunks();
+  uint32_t room = largestFreeBlock();
+  uint32_t size = FTP_CHUNK_MAX;
+  if (room < size + FTP_CHUNK_HEAP_RESERVE)
+    size = room > FTP_CHUNK_HEAP_RESERVE ? room - FTP_CHUNK_HEAP_RESERVE : 0;
+  size -= size % FTP_CHUNK_MSS;
+  if (size > FTP_BUF_SIZE && deltaBlock == 0)
+  {
+    char *p = (char *)malloc(size);
+    if (p != NULL)
+    {
+      xferBuf = p;
+      xferBufSize = size;
+    }
+  }
+  // start from the size of buf, adaptChunk() takes it from there
+  chunkSize = FTP_BUF_SIZE;
+  FTPdebug("tampon de transfert de %u octets\n", xferBufSize);
+}
+
+void FtpServer::endChunks()
+{
+  if (xferBuf != buf)
+    free(xferBuf);
+  xferBuf = buf;
+  xferBufSize = FTP_BUF_SIZE;
+}
+
+// Size of the next chunk, from the time the last one took, reading and
+// writing included: one MSS more while a full chunk costs less than half
+// of FTP_CHUNK_BUDGET_US, half as much when it costs more than the budget
+// or the heap gets short (lwIP holds the data sent until it is acked).
+void FtpServer::adaptChunk(uint32_t us, boolean full)
+{
+  uint16_t size = chunkSize;
+  if (us > FTP_CHUNK_BUDGET_US || largestFreeBlock() < FTP_CHUNK_HEAP_RESERVE)
+    size = size / 2 > FTP_CHUNK_MIN ? size / 2 : FTP_CHUNK_MIN;
+  else if (full && us < FTP_CHUNK_BUDGET_US / 2 && size < xferBufSize)
+    size = size + FTP_CHUNK_MSS < xferBufSize ? size + FTP_CHUNK_MSS : xferBufSize;
+  if (size != chunkSize)
+  {
+    FTPdebug("blocs de %u octets après %lu us\n", size, (unsigned long)us);
+  }
+  chunkSize = size;
+}
+
+// Bytes a transfer may move now, given the session and global limits
+
+uint32_t FtpServer::rateAllowance(FtpTokenBucket &session, FtpTokenBucket &global, uint32_t wanted)
+{
+  wanted = session.available(wanted);
+  return global.available(wanted);
+}
+
+// Bytes an upload may use on FTP_FS
+//
+//  total and used, if not NULL, receive the size and the usage of FTP_FS
+
+uint32_t FtpServer::freeSpace(uint32_t *total, uint32_t *used)
+{
+  uint64_t totalBytes, usedBytes;
+#ifdef ESP8266
+  FSInfo info;
+  if (!FTP_FS.info(info))
+    info.totalBytes = info.usedBytes = 0;
+  totalBytes = info.totalBytes;
+  usedBytes = info.usedBytes;
+#else
+  totalBytes = FTP_FS.totalBytes();
+  usedBytes = FTP_FS.usedBytes();
+#endif
+  if (total != NULL)
+    *total = totalBytes > 0xFFFFFFFF ? 0xFFFFFFFF : totalBytes;
+  if (used != NULL)
+    *used = usedBytes > 0xFFFFFFFF ? 0xFFFFFFFF : usedBytes;
+  if (usedBytes + FTP_FS_RESERVE >= totalBytes)
+    return 0;
+  totalBytes -= usedBytes + FTP_FS_RESERVE;
+  return totalBytes > 0xFFFFFFFF ? 0xFFFFFFFF : totalBytes;
+}
+
+void FtpServer::closeTransfer()
+{
+  // the TLS handshake of the data connection is part of the transfer time
+  uint32_t deltaT = (int32_t)(FTP_MILLIS() - millisBeginTrans);
+  if (data.secure())
+    client.println("226-TLS " + String(data.resumed() ? "session resumed in " : "full handshake in ") +
+                   String(data.handshakeTime()) + " ms");
+  if (deltaT > 0 && bytesTransfered > 0)
+  {
+    client.println("226-File successfully transferred");
+    client.println("226 " + String(deltaT) + " ms, " + String(bytesTransfered / deltaT) + " kbytes/s");
+    FTPdebug("Transfert terminé : %d bytes transférés\n", bytesTransfered);
+  }
+  else
+  {
+    FTPdebug("Transfert terminé avec succès\n");
+    client.println("226 File successfully transferred");
+  }
+
+  // The digests are only valid if the whole file went through
+  boolean complete = transferStatus == tStore || transferSize == bytesTransfered;
+  // a client that closes early, after the range it wanted, made it incomplete
+  transferComplete = transferStatus == tStore || data.connected();
+  file.close();
+  if (segment != NULL)
+    sharedFiles.release(segment);
+  segment = NULL;
   data.stop();
+  if (cacheEntry != NULL)
+  {
+    if (!cacheEntry->ready && complete)
+      cache.commit(cacheEntry);
+    else
+      cache.release(cacheEntry);
+    cacheEntry = NULL;
+  }
+  if (hashTransfer && complete)
+  {
+    FtpDigest digest;
+    hasher.finish(digest);
+    digest.save(transferPath);
+  }
+  // a RETR may have cached the old content meanwhile
+  if (transferStatus == tStore)
+    cache.invalidate(transferPath);
+  hashTransfer = false;
+  virtualFile = NULL;
 }
 
-void FtpServer::abortTransfer()
+void FtpServer::abortTransfer(const char *reply)
 {
-  if (transferStatus > 0)
+  if (transferStatus != tIdle)
   {
     file.close();
+    copyFile.close();
+    dirIter.close();
     data.stop();
-    client.println("426 Transfer aborted");
+    if (segment != NULL)
+      sharedFiles.release(segment);
+    segment = NULL;
+    if (otaStore)
+    {
+      otaAbort();
+      otaStore = false;
+    }
+    if (transferStatus == tStore && deltaBlock > 0)
+    {
+      delta.end();
+      FTP_FS.remove(transferPath);
+      deltaBlock = 0;
+    }
+    else if (transferStatus == tStore)
+      cache.invalidate(transferPath); // partly written
+    else if (transferStatus == tCopy)
+      cache.invalidate(copyDst);
+    if (cacheEntry != NULL)
+      cache.release(cacheEntry);
+    cacheEntry = NULL;
+    virtualFile = NULL;
+    client.println(reply);
     FTPdebug("Transfert avorté\n");
+    logTransfer();
+    endChunks();
   }
-  transferStatus = 0;
+  transferStatus = tIdle;
+  transferTask = 0;
+  sendLeft = 0;
+  hashTransfer = false;
 }
 
 // Read a char from client connected to ftp server
@@ -958,10 +3054,10 @@ void FtpServer::abortTransfer()
 //  update cmdLine and command buffers, iCL and parameters pointers
 //
 //  return:
-//    -2 if buffer cmdLine is full
+//    -2 if syntax error or line longer than cmdLine
 //    -1 if line not completed
 //     0 if empty line received
-//    length of cmdLine (positive) if no empty line received
+//     1 if a command line received
 
 int8_t FtpServer::readChar()
 {
@@ -984,15 +3080,19 @@ int8_t FtpServer::readChar()
     {
       if ((c != '\n'))
       {
-        if (iCL < FTP_CMD_SIZE)
+        if (iCL < FTP_CMD_SIZE - 1) // room for the final 0
         {
           cmdLine[iCL++] = c;
         }
         else
         {
-          rc = -2; //  Line too long
+          iCL = FTP_CMD_SIZE; // line too long, the rest is dropped up to its end
         }
       }
+      else if (iCL == FTP_CMD_SIZE)
+      {
+        rc = -2;
+      }
       else
       {
         cmdLine[iCL] = 0;
@@ -1005,7 +3105,7 @@ int8_t FtpServer::readChar()
         }
         else
         {
-          rc = iCL;
+          rc = 1; // iCL may not fit in rc
           // search for space between command and parameters
           parameters = strchr(cmdLine, ' ');
           if (parameters != NULL)
@@ -1028,7 +3128,10 @@ int8_t FtpServer::readChar()
             rc = -2; // Syntax error.
           }
           else
+          {
             strcpy(command, cmdLine);
+            parameters = cmdLine + iCL; // no parameters, point to the final 0
+          }
           iCL = 0;
         }
       }
@@ -1076,15 +3179,50 @@ boolean FtpServer::makePath(char *fullName, char *param)
     return true;
   }
   // If relative path, concatenate with current dir
+  size_t room = FTP_CWD_SIZE;
+  fullName[0] = 0;
   if (param[0] != '/')
   {
     strcpy(fullName, cwdName);
-    if (fullName[strlen(fullName) - 1] != '/')
-      strncat(fullName, "/", FTP_CWD_SIZE);
-    strncat(fullName, param, FTP_CWD_SIZE);
+    room -= strlen(fullName);
+    if (fullName[strlen(fullName) - 1] != '/' && room > 1)
+    {
+      strcat(fullName, "/");
+      room--;
+    }
   }
-  else
-    strcpy(fullName, param);
+  // resolved below, it must fit before
+  if (strlen(param) >= room)
+  {
+    client.println("500 Command line too long");
+    return false;
+  }
+  strcat(fullName, param);
+  // Resolve "." and ".." components, "/a/b/../c" -> "/a/c"
+  char *src = fullName, *dst = fullName;
+  while (*src != 0)
+  {
+    while (*src == '/')
+      src++;
+    char *comp = src;
+    while (*src != 0 && *src != '/')
+      src++;
+    uint16_t len = src - comp;
+    if (len == 0 || (len == 1 && comp[0] == '.'))
+      continue;
+    if (len == 2 && comp[0] == '.' && comp[1] == '.')
+    {
+      while (dst > fullName && *--dst != '/')
+        ;
+      continue;
+    }
+    *dst++ = '/';
+    memmove(dst, comp, len);
+    dst += len;
+  }
+  if (dst == fullName)
+    *dst++ = '/';
+  *dst = 0;
   // If ends with '/', remove it
   uint16_t strl = strlen(fullName) - 1;
   if (fullName[strl] == '/' && strl > 1)
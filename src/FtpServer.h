@@ -36,7 +36,10 @@
     printf_P(PSTR(x), ##__VA_ARGS__); \
   } while (0)
 #else
-#define FTPdebug(x, ...)
+#define FTPdebug(x, ...) \
+  do                     \
+  {                      \
+  } while (0)
 #endif
 
 // #include "Streaming.h"
@@ -45,11 +48,28 @@
 #include <LittleFS.h>
 
 #include <WiFiClient.h>
+#include <WiFiServer.h>
 
 #define FTP_SERVER_VERSION "FTP-2024-03-06"
 
+#ifndef FTP_CTRL_PORT
 #define FTP_CTRL_PORT 21         // Command port on which server is listening
-#define FTP_DATA_PORT_PASV 50009 // Data port in passive mode
+#endif
+#ifndef FTP_DATA_PORT_PASV
+#define FTP_DATA_PORT_PASV 50009 // Data port in passive mode, the next ones for the other servers
+#endif
+#ifndef FTP_DATA_TIMEOUT
+#define FTP_DATA_TIMEOUT 5000 // ms allowed to open a data connection
+#endif
+
+// Clock of every timeout, delay and measure of the library. A test harness
+// may give its own, extras/sim runs the server on a virtual clock.
+#ifndef FTP_MILLIS
+#define FTP_MILLIS() millis()
+#endif
+#ifndef FTP_MICROS
+#define FTP_MICROS() micros()
+#endif
 
 #define FTP_TIME_OUT 5       // Disconnect client after 5 minutes of inactivity
 #define FTP_CMD_SIZE 255 + 8 // max size of a command
@@ -58,39 +78,191 @@
 // #define FTP_BUF_SIZE 1024 //512   // size of file buffer for read/write
 #define FTP_BUF_SIZE 2 * 1460 // 512   // size of file buffer for read/write
 
+// RETR and STOR move chunks of FTP_CHUNK_MIN to FTP_CHUNK_MAX bytes,
+// adapted to the time each one takes (see adaptChunk()). Chunks larger
+// than FTP_BUF_SIZE need a buffer from the heap, allocated for the
+// transfer if FTP_CHUNK_HEAP_RESERVE bytes remain free around it.
+#ifndef FTP_CHUNK_MSS
+#ifdef TCP_MSS
+#define FTP_CHUNK_MSS TCP_MSS
+#else
+#define FTP_CHUNK_MSS 1460
+#endif
+#endif
+#ifndef FTP_CHUNK_MIN
+#define FTP_CHUNK_MIN 512
+#endif
+#ifndef FTP_CHUNK_MAX
+#ifdef ESP8266
+#define FTP_CHUNK_MAX 4 * FTP_CHUNK_MSS
+#else
+#define FTP_CHUNK_MAX 8 * FTP_CHUNK_MSS
+#endif
+#endif
+#ifndef FTP_CHUNK_HEAP_RESERVE
+#define FTP_CHUNK_HEAP_RESERVE 12 * 1024 // heap left to the rest of the sketch, and lwIP
+#endif
+#ifndef FTP_CHUNK_BUDGET_US
+#define FTP_CHUNK_BUDGET_US 10000 // time a chunk may hold loop()
+#endif
+
+#ifndef FTP_FS_MOUNT
+#define FTP_FS_MOUNT "/littlefs" // VFS mount point of FTP_FS (ESP32 only)
+#endif
+
+#ifndef FTP_HASH_ON_TRANSFER
+#define FTP_HASH_ON_TRANSFER 0 // compute the digests of the files while they are transferred (a flash write for each file)
+#endif
+
+#ifndef FTP_PROGRESS_MS
+#define FTP_PROGRESS_MS 1000 // interval of the progress lines of long SITE commands
+#endif
+
+#ifndef FTP_OTA
+#define FTP_OTA 1 // STOR to FTP_OTA_PATH writes the firmware with the Update API
+#endif
+#ifndef FTP_OTA_PATH
+#define FTP_OTA_PATH "/.ota/firmware.bin" // virtual file, never stored on FTP_FS
+#endif
+
+// RETR writes no more than the room left in the TCP send buffer, then
+// waits for it in runTransfer() instead of blocking in write(). Needs an
+// availableForWrite() that tells the truth, as the one of the ESP8266 core.
+#ifndef FTP_WRITE_WAIT
+#ifdef ESP8266
+#define FTP_WRITE_WAIT 1
+#else
+#define FTP_WRITE_WAIT 0
+#endif
+#endif
+
+#ifndef FTP_FS_RESERVE
+#define FTP_FS_RESERVE 2 * 4096 // space kept free on FTP_FS, never offered to uploads
+#endif
+
+#ifndef FTP_PROFILE
+#define FTP_PROFILE 0 // allocations and time of each command, see FtpProfile.h
+#endif
+
+#ifndef FTP_DEDUP
+#define FTP_DEDUP 0 // SITE DEDUP, with an index of the stored files by content, see FtpDedup.h
+#endif
+
+#include "FtpDir.h"
+#include "FtpHash.h"
+#include "FtpRate.h"
+#include "FtpCache.h"
+#include "FtpTls.h"
+#include "FtpAdmission.h"
+#include "FtpDelta.h"
+#include "FtpVirtual.h"
+#include "FtpShare.h"
+#include "FtpXferLog.h"
+#include "FtpTask.h"
+#include "FtpAscii.h"
+#include "FtpProfile.h"
+#include "FtpDedup.h"
+
 enum internalState
 {
+  // where runSession() is (cmdStatus)
   cInit = 0,
-  cWait,
   cCheck,
   cUserId,
   cPassword,
   cLoginOk,
-  cProcess,
 
-  tIdle,
+  // job of runTransfer() (transferStatus)
+  tIdle = 0,
   tRetrieve,
-  tStore
+  tStore,
+  tList,
+  tHash,
+  tCopy,
+  tSigs,
+  tRmtree
 };
 
 class FtpServer
 {
 public:
+  FtpServer() : sessionOpen(false), dataServer(FTP_DATA_PORT_PASV), tls(NULL), tlsRequired(false),
+                xferBuf(buf), xferBufSize(FTP_BUF_SIZE), chunkSize(FTP_BUF_SIZE), transferCounted(false) {}
   void begin(String uname, String pword);
   boolean handleFTP();
 
+  // Bandwidth limits in bytes per second, 0 for no limit. The limits of a
+  // server apply to its session, the global ones to all servers together.
+  void setRateLimit(uint32_t downBytesPerSec, uint32_t upBytesPerSec);
+  static void setGlobalRateLimit(uint32_t downBytesPerSec, uint32_t upBytesPerSec);
+
+  // RAM cache of small files served by RETR, 0 bytes to disable it.
+  // Call cacheInvalidate() after the sketch itself writes a file.
+  static void setCacheSize(uint32_t bytes, uint32_t maxFileSize = FTP_CACHE_MAX_FILE);
+  static void cacheInvalidate(const char *path);
+
+  // Files generated by the sketch, see FtpVirtual.h. path is absolute.
+  static boolean addVirtualFile(const char *path, FtpVirtualRead read, FtpVirtualSize size = NULL, void *arg = NULL);
+  static void removeVirtualFile(const char *path);
+
+  // Explicit FTPS with the TLS library of tls (see FtpTls.h). When
+  // required, USER is refused before AUTH TLS and PASV before PROT P.
+  void setTls(FtpTls *tls, boolean required = false);
+
+  // A firmware has been written by a STOR to FTP_OTA_PATH, restart to run it
+  boolean otaUpdated() { return otaDone; }
+
+  // Write the lines of the transfer log still in RAM, before a restart
+  // or a deep sleep (see FtpXferLog.h)
+  static void flushTransferLog();
+
+  // Totals of an FTP_PROFILE build, NULL after the last one (see FtpProfile.h)
+  static const FtpProfileEntry *profileEntry(uint8_t i) { return FtpProfile::entry(i); }
+
 private:
   void iniVariables();
+  void acceptClient();
   void clientConnected();
+  void endSession();
   void disconnectClient();
+  boolean runSession();
+  int8_t controlLine();
   boolean userIdentity();
   boolean userPassword();
   boolean processCommand();
+  boolean processSecurityCommand();
+  void processSiteCommand();
+  void activeMode();
   boolean dataConnect();
+  int8_t dataOpen();
+  boolean runTransfer();
+  void countTransfer();
+  boolean transferStep();
+  void sendPending();
   boolean doRetrieve();
   boolean doStore();
+  void beginChunks();
+  void endChunks();
+  void adaptChunk(uint32_t us, boolean full);
+  size_t storeWrite(const uint8_t *bytes, size_t len);
+  boolean doList();
+  boolean doHash();
+  boolean doCopy();
+  boolean doSignatures();
+  boolean doRemoveTree();
+  void statusReply();
+  void storeFirmware();
+  boolean startCopy(char *src, char *dst);
+  boolean copyTarget(char *path);
+  void hashReply(FtpDigest &digest, char cmd, const char *path, uint32_t end);
+  uint32_t rateAllowance(FtpTokenBucket &session, FtpTokenBucket &global, uint32_t wanted);
+  uint32_t freeSpace(uint32_t *total = NULL, uint32_t *used = NULL);
+  int16_t formatListEntry(char *line, uint16_t size);
+  int formatFacts(char *line, uint16_t size, uint32_t fsize, time_t mtime,
+                  boolean isDir, const char *name, boolean readOnly = false, boolean sizeKnown = true);
   void closeTransfer();
-  void abortTransfer();
+  void logTransfer();
+  void abortTransfer(const char *reply = "426 Transfer aborted");
   boolean makePath(char *fullname);
   boolean makePath(char *fullName, char *param);
   uint8_t getDateTime(uint16_t *pyear, uint8_t *pmonth, uint8_t *pday,
@@ -99,22 +271,99 @@ private:
   int8_t readChar();
 
   IPAddress dataIp; // IP address of client for data
-  WiFiClient client;
-  WiFiClient data;
+  FtpConnection client;
+  static FtpAdmission admission;
+  IPAddress clientIp;   // address of the session, for admission
+  boolean sessionOpen;  // a connection was admitted and is not closed yet
+  boolean loggedIn;
+  FtpConnection data;
+  WiFiServer dataServer; // passive data connections of this server
+  FtpTls *tls;                  // NULL without FTPS
+  boolean tlsRequired;
+  boolean pbszDone;             // PBSZ received since AUTH TLS
+  boolean protPrivate;          // PROT P: data connections use TLS
 
   File file;
+  File copyFile; // destination of SITE CPY
+  FtpDirIterator dirIter;
+  FtpHasher hasher;
+  FtpTokenBucket rateDown, rateUp; // limits of this session, RETR and STOR
+  static FtpTokenBucket globalRateDown, globalRateUp;
+  static FtpCache cache;
+  FtpCacheEntry *cacheEntry; // cache entry read or filled by the RETR in progress
+  static FtpVirtualFiles virtualFiles;
+  FtpVirtualFile *virtualFile; // served by the RETR in progress, or listed
+  static FtpSharedFiles sharedFiles;
+  static FtpXferLog xferLog;
+  static uint8_t transfersRunning; // servers with a job, the log waits for none
+  File *segment;             // shared file written by the STOR in progress after REST
+  FtpDeltaDecoder delta;     // delta STOR in progress
+  FtpBlockSum blockSum;      // checksums of the block sent by SITE SIGS
+  FtpSha256 blockSha;
 
   boolean dataPassiveConn;
+  boolean dataWaiting;  // transfer waits for its data connection, see dataOpen()
+  boolean epsvAll;      // EPSV ALL: PORT, EPRT and PASV are refused
+  uint32_t millisData;  // start of the wait for the data connection
   uint16_t dataPort;
+  uint16_t dataPortPasv;
   char buf[FTP_BUF_SIZE];     // data buffer for transfers
+  char *xferBuf;              // buffer of the RETR or STOR in progress, buf or from the heap
+  uint16_t xferBufSize;
+  uint16_t chunkSize;         // bytes moved by the next call of doRetrieve() or doStore()
+  FtpTask sessionTask;        // where runSession() goes on
+  int8_t sessionRc;           // result of controlLine() runSession() waits for
+  FtpTask transferTask;       // where runTransfer() goes on
+  boolean transferCounted;    // this server is counted in transfersRunning
+  int8_t transferRc;          // result of the step runTransfer() waits for
+  const uint8_t *sendPtr;     // bytes of the last chunk of RETR not written yet
+  uint16_t sendLeft;
   char cmdLine[FTP_CMD_SIZE]; // where to store incoming char from client
   char cwdName[FTP_CWD_SIZE]; // name of current directory
   char command[5];            // command sent by client
   boolean rnfrCmd;            // previous command was RNFR
+  char listCommand;           // 'L'IST, 'M'LSD or 'N'LST while a listing is sent
+  boolean listStat;           // the listing goes on the control connection (STAT <path>)
+  boolean listPending;        // current entry of dirIter did not fit in buf yet
+  uint16_t listCount;         // number of entries sent
+  boolean listRecursive;      // LIST -R
+  uint8_t listVirtual;        // next slot of virtualFiles to list, once dirIter is done
+  const char *listName;       // name of virtualFile in the listing
+  boolean listFiltered;       // the listing only sends the names matching listGlob
+  FtpGlob listGlob;
+  char transferPath[FTP_CWD_SIZE]; // file of the transfer in progress
+  uint32_t transferSize;      // size of the file being retrieved, or bytes written by STOR
+  boolean restart;            // REST received for the next RETR or STOR
+  uint32_t restartPos;        // offset given by REST
+  uint32_t transferOffset;    // offset in the file of the first byte of the transfer
+  boolean transferComplete;   // the transfer that just ended went through, for the log
+  boolean hashTransfer;       // digests of transferPath are computed during the transfer
+  char hashCommand;           // 'H'ASH or 'X'CRC being answered by doHash()
+  boolean hashCrc;            // algorithm selected by OPTS HASH is CRC32 (else SHA-256)
+  uint32_t hashPos, hashEnd;  // range hashed by doHash() or doSignatures()
+  uint16_t sigBlock;          // block size of SITE SIGS
+  uint16_t deltaBlock;        // block size of SITE DELTA, 0 when STOR receives the file itself
+  boolean otaStore;           // STOR in progress writes the firmware
+  boolean asciiType;          // TYPE A: text files go with CRLF line ends
+  boolean asciiTransfer;      // the RETR or STOR in progress translates its line ends
+  boolean asciiCR;            // last byte sent was a CR (RETR), or CR held back (STOR)
+  uint16_t asciiRoom;         // RETR: room left in xferBuf for the CRs of a chunk
+  boolean otaCheck;           // otaSha was given by SITE OTA
+  uint8_t otaSha[32];         // expected SHA-256 of the next firmware
+  boolean otaDone;            // a firmware was written since begin()
+  uint32_t allocSize;         // size announced by ALLO for the next STOR
+  char copyDst[FTP_CWD_SIZE]; // destination of SITE CPY, the source is in transferPath
+  boolean copyTree;           // SITE CPY of a directory, walked with dirIter
+  uint16_t copyFiles;         // files copied so far
+  uint16_t copySkipped;       // entries of the tree whose copy has too long a path
+  uint32_t removedFiles;      // files removed so far by SITE RMTREE
+  uint16_t removedDirs;       // and directories
+  boolean removedSome;        // the current pass of SITE RMTREE removed something
+  uint32_t millisProgress;    // time of the next progress line
   char *parameters;           // point to begin of parameters sent by client
   uint16_t iCL;               // pointer to cmdLine next incoming char
   // int8_t   cmdStatus;               // status of ftp command connexion
-  int8_t transferStatus;  // status of ftp data transfer
+  internalState transferStatus; // status of ftp data transfer
   uint32_t millisTimeOut, // disconnect after 5 min of inactivity
       millisDelay,
       millisEndConnection, //
@@ -124,8 +373,7 @@ private:
   String _FTP_PASS;
   boolean transfer_en_cours;
 
-  internalState cmdStatus, // state of ftp control connection
-      transferState;       // state of ftp data connection
+  internalState cmdStatus; // state of ftp control connection
 };
 
 #endif // FTP_SERVERESP_H
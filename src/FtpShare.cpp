@@ -0,0 +1,80 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Files written by several sessions at once
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpServer.h"
+
+FtpSharedFiles::FtpSharedFiles()
+{
+  for (uint8_t i = 0; i < FTP_SHARED_FILES; i++)
+  {
+    entries[i].path = NULL;
+    entries[i].users = 0;
+  }
+}
+
+FtpSharedFiles::Entry *FtpSharedFiles::find(const char *path)
+{
+  for (uint8_t i = 0; i < FTP_SHARED_FILES; i++)
+    if (entries[i].path != NULL && !strcmp(entries[i].path, path))
+      return &entries[i];
+  return NULL;
+}
+
+File *FtpSharedFiles::open(const char *path)
+{
+  Entry *e = find(path);
+  for (uint8_t i = 0; e == NULL && i < FTP_SHARED_FILES; i++)
+    if (entries[i].path == NULL)
+    {
+      // "r+" fails on a missing file
+      File f = FTP_FS.exists(path) ? FTP_FS.open(path, "r+") : FTP_FS.open(path, "w");
+      if (!f)
+        return NULL;
+      entries[i].path = strdup(path);
+      if (entries[i].path == NULL)
+      {
+        f.close();
+        return NULL;
+      }
+      entries[i].file = f;
+      entries[i].users = 0;
+      e = &entries[i];
+      FTPdebug("%s ouvert pour des segments\n", path);
+    }
+  if (e == NULL)
+    return NULL;
+  e->users++;
+  return &e->file;
+}
+
+void FtpSharedFiles::release(File *file)
+{
+  for (uint8_t i = 0; i < FTP_SHARED_FILES; i++)
+    if (entries[i].path != NULL && &entries[i].file == file && --entries[i].users == 0)
+    {
+      entries[i].file.close();
+      FTPdebug("%s fermé\n", entries[i].path);
+      free(entries[i].path);
+      entries[i].path = NULL;
+    }
+}
+
+boolean FtpSharedFiles::busy(const char *path)
+{
+  return find(path) != NULL;
+}
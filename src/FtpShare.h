@@ -0,0 +1,58 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Files written by several sessions at once
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FTP_SHARE_H
+#define FTP_SHARE_H
+
+// A segmented upload sends the ranges of one file from several sessions,
+// each with REST <offset> then STOR. LittleFS gives every handle its own
+// copy of the file, committed on close: two sessions writing through
+// their own handle would each overwrite the blocks of the other one.
+// The sessions of such an upload share the File opened by the first
+// one, and seek to their own offset before each write.
+//
+// Include through FtpServer.h.
+
+#ifndef FTP_SHARED_FILES
+#define FTP_SHARED_FILES 2 // files written by segments at the same time
+#endif
+
+class FtpSharedFiles
+{
+public:
+  FtpSharedFiles();
+
+  // File of path opened for writing without truncating it, created if
+  // needed, NULL if it can't be opened or all the slots are used
+  File *open(const char *path);
+  void release(File *file); // closed when its last session releases it
+  boolean busy(const char *path);
+
+private:
+  struct Entry
+  {
+    char *path; // NULL when the slot is free
+    File file;
+    uint8_t users;
+  };
+  Entry *find(const char *path);
+
+  Entry entries[FTP_SHARED_FILES];
+};
+
+#endif // FTP_SHARE_H
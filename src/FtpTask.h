@@ -0,0 +1,88 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Tasks that wait without blocking loop()
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FTP_TASK_H
+#define FTP_TASK_H
+
+// Protothreads: a function written from top to bottom that returns at each
+// wait, and goes on from there when it is called again. The ESP8266 core
+// builds C++17, where C++20 coroutines don't exist (the ESP32 core 3.x has
+// them, but allocates their frames on the heap). This only takes a switch
+// and the line where the task waits, kept in an FtpTask (2 bytes instead
+// of a stack).
+//
+//   boolean FtpServer::runTransfer()
+//   {
+//     FTP_TASK_BEGIN(transferTask);
+//     FTP_TASK_WAIT_UNTIL(transferTask, data.connected());
+//     ...
+//     FTP_TASK_END(transferTask);
+//   }
+//
+// The task returns true while it runs, false once it is over. Locals don't
+// survive a wait, what must be kept goes in members. There can't be two
+// waits on one line, nor a wait inside a switch of the task.
+//
+// Include through FtpServer.h.
+
+typedef uint16_t FtpTask; // line to go on from, 0 to start at the top
+
+#define FTP_TASK_BEGIN(t) \
+  switch (t)              \
+  {                       \
+  case 0:
+
+// The case labels of a wait follow statements, the fall through them is
+// on purpose: said so for -Wimplicit-fallthrough (-Wextra).
+#define FTP_TASK_FALLTHROUGH __attribute__((fallthrough))
+
+// Return until cond holds
+#define FTP_TASK_WAIT_UNTIL(t, cond) \
+  do                                 \
+  {                                  \
+    (t) = __LINE__;                  \
+    FTP_TASK_FALLTHROUGH;            \
+  case __LINE__:                     \
+    if (!(cond))                     \
+      return true;                   \
+  } while (0)
+
+// Give loop() back once
+#define FTP_TASK_YIELD(t) \
+  do                      \
+  {                       \
+    (t) = __LINE__;       \
+    return true;          \
+    FTP_TASK_FALLTHROUGH; \
+  case __LINE__:;         \
+  } while (0)
+
+// End before the bottom
+#define FTP_TASK_EXIT(t) \
+  do                     \
+  {                      \
+    (t) = 0;             \
+    return false;        \
+  } while (0)
+
+#define FTP_TASK_END(t) \
+  }                     \
+  (t) = 0;              \
+  return false
+
+#endif // FTP_TASK_H
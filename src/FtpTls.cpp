@@ -0,0 +1,264 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Explicit FTPS: TLS on the control and data connections
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpServer.h"
+
+#ifndef ESP8266
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+FtpTlsSessionCache::FtpTlsSessionCache()
+{
+  memset(entries, 0, sizeof(entries));
+  clock = 0;
+  hits = misses = 0;
+}
+
+FtpTlsSessionCache::Entry *FtpTlsSessionCache::find(const uint8_t *id, uint8_t idLen)
+{
+  for (uint8_t i = 0; i < FTP_TLS_SESSIONS; i++)
+    if (entries[i].idLen == idLen && idLen > 0 && !memcmp(entries[i].id, id, idLen))
+      return &entries[i];
+  return NULL;
+}
+
+void FtpTlsSessionCache::save(const uint8_t *id, uint8_t idLen, const uint8_t *session, uint16_t len)
+{
+  if (idLen == 0 || idLen > FTP_TLS_ID_SIZE || len > FTP_TLS_SESSION_SIZE)
+  {
+    FTPdebug("session TLS de %u octets non gardée\n", len);
+    return;
+  }
+  Entry *e = find(id, idLen);
+  if (e == NULL)
+  {
+    // a free entry, or else the least recently used
+    e = &entries[0];
+    for (uint8_t i = 1; i < FTP_TLS_SESSIONS && e->idLen != 0; i++)
+      if (entries[i].idLen == 0 || clock - entries[i].used > clock - e->used)
+        e = &entries[i];
+    memcpy(e->id, id, idLen);
+    e->idLen = idLen;
+  }
+  memcpy(e->session, session, len);
+  e->len = len;
+  e->used = ++clock;
+}
+
+uint16_t FtpTlsSessionCache::load(const uint8_t *id, uint8_t idLen, uint8_t *session, uint16_t size)
+{
+  Entry *e = find(id, idLen);
+  if (e == NULL || e->len > size)
+  {
+    misses++;
+    return 0;
+  }
+  hits++;
+  memcpy(session, e->session, e->len);
+  e->used = ++clock;
+  return e->len;
+}
+
+void FtpTlsSessionCache::remove(const uint8_t *id, uint8_t idLen)
+{
+  Entry *e = find(id, idLen);
+  if (e != NULL)
+    e->idLen = 0;
+}
+
+FtpConnection &FtpConnection::operator=(const WiFiClient &client)
+{
+  stop();
+  sock = client;
+  return *this;
+}
+
+boolean FtpConnection::startTls(FtpTls *provider)
+{
+  if (provider == NULL || tls != NULL)
+    return false;
+  tls = provider->accept(sock);
+  tlsReady = false;
+  tlsResumed = false;
+  tlsMillis = FTP_MILLIS();
+  return tls != NULL;
+}
+
+int8_t FtpConnection::handshake()
+{
+  if (tlsReady)
+    return 1;
+  if (tls == NULL)
+    return -1;
+  int8_t rc = tls->handshake();
+  if (rc == 0 && FTP_MILLIS() - tlsMillis < FTP_TLS_TIMEOUT && sock.connected())
+    return 0;
+  tlsMillis = FTP_MILLIS() - tlsMillis;
+  if (rc != 1)
+  {
+    FTPdebug("échec de la négociation TLS après %lu ms\n", (unsigned long)tlsMillis);
+    delete tls;
+    tls = NULL;
+    sock.stop();
+    return -1;
+  }
+  tlsReady = true;
+  tlsResumed = tls->resumed();
+  FTPdebug("TLS négocié en %lu ms%s\n", (unsigned long)tlsMillis, tlsResumed ? ", session reprise" : "");
+  return 1;
+}
+
+size_t FtpConnection::write(const uint8_t *buf, size_t size)
+{
+  return tls != NULL ? tls->write(buf, size) : sock.write(buf, size);
+}
+
+int FtpConnection::availableForWrite()
+{
+  int room = sock.availableForWrite();
+  if (tls == NULL)
+    return room;
+  // leave room for the header and the tag of the record
+  return room > 64 ? room - 64 : 0;
+}
+
+int FtpConnection::available()
+{
+  return tls != NULL ? tls->available() : sock.available();
+}
+
+int FtpConnection::read()
+{
+  if (tls == NULL)
+    return sock.read();
+  uint8_t c;
+  return tls->read(&c, 1) == 1 ? c : -1;
+}
+
+int FtpConnection::read(uint8_t *buf, size_t size)
+{
+  return tls != NULL ? tls->read(buf, size) : sock.read(buf, size);
+}
+
+size_t FtpConnection::readBytes(char *buf, size_t size)
+{
+  // never waits, unlike Stream::readBytes()
+  int nb = read((uint8_t *)buf, size);
+  return nb > 0 ? nb : 0;
+}
+
+int FtpConnection::peek()
+{
+  return tls != NULL ? -1 : sock.peek();
+}
+
+int FtpConnection::connect(IPAddress ip, uint16_t port)
+{
+  stop();
+  return sock.connect(ip, port);
+}
+
+boolean FtpConnection::connectStart(IPAddress ip, uint16_t port)
+{
+  stop();
+  connectMillis = FTP_MILLIS();
+#ifdef ESP8266
+  return sock.connect(ip, port);
+#else
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return false;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = (uint32_t)ip;
+  if (::connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 && errno != EINPROGRESS)
+  {
+    FTPdebug("connexion à %s:%u impossible\n", ip.toString().c_str(), port);
+    ::close(fd);
+    return false;
+  }
+  connectFd = fd;
+  return true;
+#endif
+}
+
+int8_t FtpConnection::connecting()
+{
+#ifdef ESP8266
+  return sock.connected() ? 1 : -1;
+#else
+  if (connectFd < 0)
+    return sock.connected() ? 1 : -1;
+  fd_set wr;
+  struct timeval tv = {0, 0};
+  FD_ZERO(&wr);
+  FD_SET(connectFd, &wr);
+  int rc = select(connectFd + 1, NULL, &wr, NULL, &tv);
+  if (rc == 0 && FTP_MILLIS() - connectMillis < FTP_DATA_TIMEOUT)
+    return 0;
+  int err = -1;
+  socklen_t len = sizeof(err);
+  if (rc <= 0 || getsockopt(connectFd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+  {
+    FTPdebug("échec de la connexion de données après %lu ms\n", (unsigned long)(FTP_MILLIS() - connectMillis));
+    ::close(connectFd);
+    connectFd = -1;
+    return -1;
+  }
+  FTPdebug("connexion de données en %lu ms\n", (unsigned long)(FTP_MILLIS() - connectMillis));
+  sock = WiFiClient(connectFd);
+  connectFd = -1;
+  return 1;
+#endif
+}
+
+void FtpConnection::stop()
+{
+#ifndef ESP8266
+  if (connectFd >= 0)
+  {
+    ::close(connectFd);
+    connectFd = -1;
+  }
+#endif
+  if (tls != NULL)
+  {
+    tls->close();
+    delete tls;
+    tls = NULL;
+  }
+  tlsReady = false;
+  tlsResumed = false;
+  sock.stop();
+}
+
+uint8_t FtpConnection::connected()
+{
+  if (tls == NULL)
+    return sock.connected();
+  // a client may wait for our close_notify before closing the socket
+  return tls->available() > 0 || (sock.connected() && !tls->closed());
+}
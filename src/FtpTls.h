@@ -0,0 +1,168 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Explicit FTPS: TLS on the control and data connections
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FTP_TLS_H
+#define FTP_TLS_H
+
+// AUTH TLS secures the control connection, PBSZ 0 and PROT P the data
+// connections (RFC 4217). The TLS library is given to the server with
+// FtpServer::setTls(): an FtpTls creates the server side of a session on
+// an accepted socket.
+//
+// A client opens the data connections with the TLS session of the
+// control connection. The FtpTls keeps the last FTP_TLS_SESSIONS
+// sessions in its FtpTlsSessionCache so that these handshakes are
+// abbreviated ones, without the public key operations that take seconds
+// on an ESP8266. A provider gives the cache each new session, saved in
+// its own format (the session parameters of BearSSL, the output of
+// mbedtls_ssl_session_save() or i2d_SSL_SESSION()), and asks it for the
+// session whose id a client offers.
+//
+// The ESP8266 has one over the BearSSL of its core in FtpTlsBearSSL.h,
+// the host build one over OpenSSL in extras/host. There is none for the
+// ESP32 yet: without a provider, AUTH TLS is refused and not listed by
+// FEAT.
+//
+// Include through FtpServer.h.
+
+#ifndef FTP_TLS_SESSIONS
+#define FTP_TLS_SESSIONS 4 // TLS sessions kept for resumption
+#endif
+#ifndef FTP_TLS_SESSION_SIZE
+#define FTP_TLS_SESSION_SIZE 192 // bytes of a saved session, larger ones are not kept
+#endif
+#ifndef FTP_TLS_TIMEOUT
+#define FTP_TLS_TIMEOUT 10000 // ms allowed for a handshake
+#endif
+
+#define FTP_TLS_ID_SIZE 32 // longest session id (TLS 1.2)
+
+// The sessions of the provider, by id. The least recently used one makes
+// room for a new one.
+class FtpTlsSessionCache
+{
+public:
+  FtpTlsSessionCache();
+
+  void save(const uint8_t *id, uint8_t idLen, const uint8_t *session, uint16_t len);
+  // Copy in session (size bytes) the session of this id: its length, or 0
+  // if it is not there
+  uint16_t load(const uint8_t *id, uint8_t idLen, uint8_t *session, uint16_t size);
+  void remove(const uint8_t *id, uint8_t idLen);
+
+  uint32_t hits;   // sessions resumed
+  uint32_t misses; // ids offered that were not there
+
+private:
+  struct Entry
+  {
+    uint8_t id[FTP_TLS_ID_SIZE];
+    uint8_t idLen; // 0 when the entry is free
+    uint16_t len;
+    uint32_t used; // value of clock when last saved or loaded
+    uint8_t session[FTP_TLS_SESSION_SIZE];
+  };
+  Entry *find(const uint8_t *id, uint8_t idLen);
+
+  Entry entries[FTP_TLS_SESSIONS];
+  uint32_t clock;
+};
+
+class FtpTlsSession
+{
+public:
+  virtual ~FtpTlsSession() {}
+
+  virtual int8_t handshake() = 0; // 1 done, 0 to be called again, -1 failed
+  virtual boolean resumed() = 0;  // abbreviated handshake, from the session cache
+  virtual boolean closed() = 0;   // close_notify received from the peer
+  virtual int available() = 0;
+  virtual int read(uint8_t *buf, size_t size) = 0;
+  virtual size_t write(const uint8_t *buf, size_t size) = 0;
+  virtual void close() = 0; // send close_notify, the socket is stopped by the caller
+};
+
+class FtpTls
+{
+public:
+  virtual ~FtpTls() {}
+
+  // Server side of a TLS session on sock, NULL if it can't be created
+  virtual FtpTlsSession *accept(WiFiClient &sock) = 0;
+
+protected:
+  FtpTlsSessionCache sessions;
+};
+
+// Control or data connection, in clear or through TLS once the handshake
+// started by startTls() is over. Used like the WiFiClient it wraps.
+class FtpConnection : public Stream
+{
+public:
+  FtpConnection() : tls(NULL), tlsReady(false), tlsResumed(false), connectFd(-1) {}
+  ~FtpConnection() { stop(); }
+  FtpConnection(const FtpConnection &) = delete;
+
+  FtpConnection &operator=(const WiFiClient &client); // new connection, in clear
+
+  // The handshake goes on in handshake(), called until it is not 0:
+  // 1 when done, -1 if it failed or took more than FTP_TLS_TIMEOUT, the
+  // connection is then closed.
+  boolean startTls(FtpTls *provider);
+  int8_t handshake();
+  boolean handshaking() { return tls != NULL && !tlsReady; }
+  boolean secure() { return tlsReady; }
+  boolean resumed() { return tlsResumed; }
+  uint32_t handshakeTime() { return tlsMillis; } // duration of the last handshake
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buf, size_t size) override;
+  using Print::write;
+  int availableForWrite() override;
+  int available() override;
+  int read() override;
+  int read(uint8_t *buf, size_t size);
+  size_t readBytes(char *buf, size_t size);
+  int peek() override;
+  void flush() override {}
+
+  int connect(IPAddress ip, uint16_t port);
+  // Active mode: connectStart() begins a connection to ip:port, then
+  // connecting() is called until it is not 0: 1 when connected, -1 if it
+  // failed or took more than FTP_DATA_TIMEOUT.
+  // The ESP8266 core has no non-blocking connect: connectStart() waits
+  // there for the connection, like connect().
+  boolean connectStart(IPAddress ip, uint16_t port);
+  int8_t connecting();
+  void stop();
+  uint8_t connected();
+  operator bool() { return (bool)sock; }
+  IPAddress localIP() { return sock.localIP(); }
+  IPAddress remoteIP() { return sock.remoteIP(); }
+
+private:
+  WiFiClient sock;
+  FtpTlsSession *tls;
+  boolean tlsReady;
+  boolean tlsResumed;
+  uint32_t tlsMillis; // start of the handshake, then its duration
+  int connectFd;      // socket of connectStart() until it is connected
+  uint32_t connectMillis;
+};
+
+#endif // FTP_TLS_H
@@ -0,0 +1,240 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * BearSSL provider of FtpTls for the ESP8266
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpTlsBearSSL.h"
+
+#ifdef ESP8266
+
+#include <StackThunk.h>
+
+// The engine runs on the second stack of the core, as in WiFiClientSecure:
+// the public key operations of a handshake need more than loop() has.
+extern "C"
+{
+  extern unsigned char *thunk_br_ssl_engine_recvapp_buf(const br_ssl_engine_context *cc, size_t *len);
+  extern void thunk_br_ssl_engine_recvapp_ack(br_ssl_engine_context *cc, size_t len);
+  extern unsigned char *thunk_br_ssl_engine_recvrec_buf(const br_ssl_engine_context *cc, size_t *len);
+  extern void thunk_br_ssl_engine_recvrec_ack(br_ssl_engine_context *cc, size_t len);
+  extern unsigned char *thunk_br_ssl_engine_sendapp_buf(const br_ssl_engine_context *cc, size_t *len);
+  extern void thunk_br_ssl_engine_sendapp_ack(br_ssl_engine_context *cc, size_t len);
+  extern unsigned char *thunk_br_ssl_engine_sendrec_buf(const br_ssl_engine_context *cc, size_t *len);
+  extern void thunk_br_ssl_engine_sendrec_ack(br_ssl_engine_context *cc, size_t len);
+}
+#define br_ssl_engine_recvapp_buf thunk_br_ssl_engine_recvapp_buf
+#define br_ssl_engine_recvapp_ack thunk_br_ssl_engine_recvapp_ack
+#define br_ssl_engine_recvrec_buf thunk_br_ssl_engine_recvrec_buf
+#define br_ssl_engine_recvrec_ack thunk_br_ssl_engine_recvrec_ack
+#define br_ssl_engine_sendapp_buf thunk_br_ssl_engine_sendapp_buf
+#define br_ssl_engine_sendapp_ack thunk_br_ssl_engine_sendapp_ack
+#define br_ssl_engine_sendrec_buf thunk_br_ssl_engine_sendrec_buf
+#define br_ssl_engine_sendrec_ack thunk_br_ssl_engine_sendrec_ack
+
+// The server context and what loadSession() tells about it
+struct FtpTlsBearSSLServer
+{
+  br_ssl_server_context sc; // first, the cache is given its address
+  boolean resumed;
+};
+
+class FtpTlsBearSSLSession : public FtpTlsSession
+{
+public:
+  FtpTlsBearSSLSession(WiFiClient &sock) : sock(sock), iobuf(NULL) { stack_thunk_add_ref(); }
+  ~FtpTlsBearSSLSession()
+  {
+    free(iobuf);
+    stack_thunk_del_ref();
+  }
+
+  boolean begin(FtpTlsBearSSL *tls)
+  {
+    iobuf = (uint8_t *)malloc(BR_SSL_BUFSIZE_INPUT + FTP_TLS_OUT_SIZE);
+    if (iobuf == NULL)
+      return false;
+    const br_x509_certificate *certs = tls->chain->getX509Certs();
+    size_t count = tls->chain->getCount();
+    if (tls->key->isRSA())
+      br_ssl_server_init_full_rsa(&server.sc, certs, count, tls->key->getRSA());
+    else if (tls->key->isEC())
+      br_ssl_server_init_full_ec(&server.sc, certs, count, tls->issuerKeyType, tls->key->getEC());
+    else
+      return false;
+    br_ssl_engine_set_buffers_bidi(eng(), iobuf, BR_SSL_BUFSIZE_INPUT, iobuf + BR_SSL_BUFSIZE_INPUT, FTP_TLS_OUT_SIZE);
+    br_ssl_server_set_cache(&server.sc, &tls->cache.vtable);
+    server.resumed = false;
+    return br_ssl_server_reset(&server.sc) != 0;
+  }
+
+  int8_t handshake() override
+  {
+    if (!pump())
+    {
+      FTPdebug("TLS : erreur BearSSL %d\n", br_ssl_engine_last_error(eng()));
+      return -1;
+    }
+    return (br_ssl_engine_current_state(eng()) & BR_SSL_SENDAPP) ? 1 : 0;
+  }
+
+  boolean resumed() override { return server.resumed; }
+
+  boolean closed() override { return (br_ssl_engine_current_state(eng()) & BR_SSL_CLOSED) != 0; }
+
+  int available() override
+  {
+    size_t len = 0;
+    if (pump() && (br_ssl_engine_current_state(eng()) & BR_SSL_RECVAPP))
+      br_ssl_engine_recvapp_buf(eng(), &len);
+    return len;
+  }
+
+  int read(uint8_t *buf, size_t size) override
+  {
+    size_t len = available();
+    if (len == 0)
+      return 0;
+    uint8_t *app = br_ssl_engine_recvapp_buf(eng(), &len);
+    if (len > size)
+      len = size;
+    memcpy(buf, app, len);
+    br_ssl_engine_recvapp_ack(eng(), len);
+    return len;
+  }
+
+  size_t write(const uint8_t *buf, size_t size) override
+  {
+    // blocks like WiFiClient::write() until everything is queued
+    size_t sent = 0;
+    uint32_t start = FTP_MILLIS();
+    while (sent < size && pump())
+    {
+      size_t len = 0;
+      uint8_t *app = (br_ssl_engine_current_state(eng()) & BR_SSL_SENDAPP) ? br_ssl_engine_sendapp_buf(eng(), &len) : NULL;
+      if (app == NULL || len == 0)
+      {
+        // the records wait for room in the socket
+        if (!sock.connected() || FTP_MILLIS() - start > FTP_TLS_TIMEOUT)
+          break;
+        yield();
+        continue;
+      }
+      if (len > size - sent)
+        len = size - sent;
+      memcpy(app, buf + sent, len);
+      br_ssl_engine_sendapp_ack(eng(), len);
+      sent += len;
+      start = FTP_MILLIS();
+    }
+    br_ssl_engine_flush(eng(), 0);
+    pump();
+    return sent;
+  }
+
+  void close() override
+  {
+    br_ssl_engine_close(eng());
+    pump();
+  }
+
+private:
+  br_ssl_engine_context *eng() { return &server.sc.eng; }
+
+  // Move the records between the engine and the socket, as long as the
+  // socket takes or has some
+  //
+  //  return false once the engine is closed
+  boolean pump()
+  {
+    while (true)
+    {
+      unsigned state = br_ssl_engine_current_state(eng());
+      if (state & BR_SSL_CLOSED)
+        return false;
+      size_t len;
+      if (state & BR_SSL_SENDREC)
+      {
+        int room = sock.availableForWrite();
+        if (room <= 0)
+          return true;
+        uint8_t *rec = br_ssl_engine_sendrec_buf(eng(), &len);
+        size_t n = sock.write(rec, len < (size_t)room ? len : room);
+        if (n == 0)
+          return true;
+        br_ssl_engine_sendrec_ack(eng(), n);
+      }
+      else if ((state & BR_SSL_RECVREC) && sock.available() > 0)
+      {
+        uint8_t *rec = br_ssl_engine_recvrec_buf(eng(), &len);
+        int n = sock.read(rec, len);
+        if (n <= 0)
+          return true;
+        br_ssl_engine_recvrec_ack(eng(), n);
+      }
+      else
+        return true;
+    }
+  }
+
+  WiFiClient &sock;
+  uint8_t *iobuf;
+  FtpTlsBearSSLServer server;
+};
+
+FtpTlsBearSSL::FtpTlsBearSSL(const BearSSL::X509List *chain, const BearSSL::PrivateKey *key, unsigned issuerKeyType)
+    : chain(chain), key(key), issuerKeyType(issuerKeyType)
+{
+  static const br_ssl_session_cache_class vtable = {sizeof(cache), saveSession, loadSession};
+  cache.vtable = &vtable;
+  cache.tls = this;
+}
+
+void FtpTlsBearSSL::saveSession(const br_ssl_session_cache_class **ctx, br_ssl_server_context *server,
+                                const br_ssl_session_parameters *params)
+{
+  (void)server;
+  FtpTlsBearSSL *tls = ((Cache *)ctx)->tls;
+  tls->sessions.save(params->session_id, params->session_id_len, (const uint8_t *)params, sizeof(*params));
+}
+
+int FtpTlsBearSSL::loadSession(const br_ssl_session_cache_class **ctx, br_ssl_server_context *server,
+                               br_ssl_session_parameters *params)
+{
+  FtpTlsBearSSL *tls = ((Cache *)ctx)->tls;
+  // the id offered by the client is already in params
+  br_ssl_session_parameters saved;
+  if (tls->sessions.load(params->session_id, params->session_id_len, (uint8_t *)&saved, sizeof(saved)) != sizeof(saved))
+    return 0;
+  *params = saved;
+  ((FtpTlsBearSSLServer *)server)->resumed = true;
+  return 1;
+}
+
+FtpTlsSession *FtpTlsBearSSL::accept(WiFiClient &sock)
+{
+  if (chain == NULL || key == NULL)
+    return NULL;
+  FtpTlsBearSSLSession *session = new FtpTlsBearSSLSession(sock);
+  if (!session->begin(this))
+  {
+    FTPdebug("TLS : session BearSSL impossible\n");
+    delete session;
+    return NULL;
+  }
+  return session;
+}
+
+#endif // ESP8266
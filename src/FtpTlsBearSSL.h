@@ -0,0 +1,81 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * BearSSL provider of FtpTls for the ESP8266
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FTP_TLS_BEARSSL_H
+#define FTP_TLS_BEARSSL_H
+
+#include "FtpServer.h"
+
+#ifdef ESP8266
+
+#include <BearSSLHelpers.h>
+
+// The BearSSL engine of the ESP8266 core, run on the socket of an FTP
+// connection: WiFiServerSecure only secures the connections it accepts
+// itself, AUTH TLS secures one that is already open.
+//
+//   BearSSL::X509List chain(certPem);
+//   BearSSL::PrivateKey key(keyPem);
+//   FtpTlsBearSSL tls(&chain, &key);
+//   ...
+//   ftpSrv.setTls(&tls);
+//
+// The chain and the key, RSA or EC, must last as long as the provider.
+// The session parameters of BearSSL go in the FtpTlsSessionCache.
+//
+// A session takes about 20 kB of heap, its input buffer holds a whole
+// record: two of them are open during a transfer with PROT P. The full
+// handshake of the control connection holds loop() for its public key
+// operation, about a second with RSA-2048; the data connections resume
+// its session instead.
+
+#ifndef FTP_TLS_OUT_SIZE
+#define FTP_TLS_OUT_SIZE 837 // output buffer of a session, records of 512 bytes
+#endif
+
+class FtpTlsBearSSL : public FtpTls
+{
+public:
+  // issuerKeyType: type of the key that signed the certificate of an EC
+  // key, BR_KEYTYPE_RSA or BR_KEYTYPE_EC
+  FtpTlsBearSSL(const BearSSL::X509List *chain, const BearSSL::PrivateKey *key,
+                unsigned issuerKeyType = BR_KEYTYPE_EC);
+
+  FtpTlsSession *accept(WiFiClient &sock) override;
+
+private:
+  friend class FtpTlsBearSSLSession;
+
+  static void saveSession(const br_ssl_session_cache_class **ctx, br_ssl_server_context *server,
+                          const br_ssl_session_parameters *params);
+  static int loadSession(const br_ssl_session_cache_class **ctx, br_ssl_server_context *server,
+                         br_ssl_session_parameters *params);
+
+  const BearSSL::X509List *chain;
+  const BearSSL::PrivateKey *key;
+  unsigned issuerKeyType;
+  struct Cache
+  {
+    const br_ssl_session_cache_class *vtable; // first, BearSSL is given its address
+    FtpTlsBearSSL *tls;
+  } cache;
+};
+
+#endif // ESP8266
+
+#endif // FTP_TLS_BEARSSL_H
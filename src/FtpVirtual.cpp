@@ -0,0 +1,80 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Virtual files generated by the sketch
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpServer.h"
+
+FtpVirtualFiles::FtpVirtualFiles()
+{
+  memset(files, 0, sizeof(files));
+}
+
+boolean FtpVirtualFiles::add(const char *path, FtpVirtualRead read, FtpVirtualSize size, void *arg)
+{
+  if (path[0] != '/' || path[1] == 0 || read == NULL || strlen(path) >= FTP_CWD_SIZE)
+    return false;
+  FtpVirtualFile *vf = find(path);
+  for (uint8_t i = 0; vf == NULL && i < FTP_VIRTUAL_FILES; i++)
+    if (files[i].path == NULL)
+    {
+      files[i].path = strdup(path);
+      if (files[i].path == NULL)
+        return false;
+      vf = &files[i];
+    }
+  if (vf == NULL)
+    return false;
+  vf->read = read;
+  vf->size = size;
+  vf->arg = arg;
+  return true;
+}
+
+void FtpVirtualFiles::remove(const char *path)
+{
+  FtpVirtualFile *vf = find(path);
+  if (vf != NULL)
+  {
+    free(vf->path);
+    memset(vf, 0, sizeof(*vf));
+  }
+}
+
+FtpVirtualFile *FtpVirtualFiles::find(const char *path)
+{
+  for (uint8_t i = 0; i < FTP_VIRTUAL_FILES; i++)
+    if (files[i].path != NULL && !strcmp(files[i].path, path))
+      return &files[i];
+  return NULL;
+}
+
+FtpVirtualFile *FtpVirtualFiles::next(const char *dir, boolean recursive, uint8_t &index, const char **name)
+{
+  size_t n = strlen(dir);
+  if (n > 0 && dir[n - 1] == '/')
+    n--; // "/" or "/dir/"
+  while (index < FTP_VIRTUAL_FILES)
+  {
+    FtpVirtualFile *vf = &files[index++];
+    if (vf->path == NULL || strncmp(vf->path, dir, n) || vf->path[n] != '/')
+      continue;
+    *name = vf->path + n + 1;
+    if (recursive || strchr(*name, '/') == NULL)
+      return vf;
+  }
+  return NULL;
+}
@@ -0,0 +1,68 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Virtual files generated by the sketch
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FTP_VIRTUAL_H
+#define FTP_VIRTUAL_H
+
+// Files whose content is produced by the sketch when a client reads them:
+// logs kept in a RAM ring buffer, sensor readings, status... They are
+// served by RETR, a buffer per call of doRetrieve(), and appear in LIST,
+// MLSD, NLST, MLST and SIZE next to the files of FTP_FS, read only.
+//
+// read(offset, buf, len, arg) fills buf with at most len bytes starting
+// at offset and returns their number, 0 at the end of the content.
+// size(arg) gives the size shown in the listings; without it the size is
+// unknown: LIST, MLSD and MLST leave it out, and SIZE fails.
+//
+// Include through FtpServer.h.
+
+#ifndef FTP_VIRTUAL_FILES
+#define FTP_VIRTUAL_FILES 8 // max number of virtual files
+#endif
+
+typedef size_t (*FtpVirtualRead)(uint32_t offset, uint8_t *buf, size_t len, void *arg);
+typedef uint32_t (*FtpVirtualSize)(void *arg);
+
+struct FtpVirtualFile
+{
+  char *path; // NULL when the slot is free
+  FtpVirtualRead read;
+  FtpVirtualSize size;
+  void *arg;
+
+  uint32_t getSize() { return size != NULL ? size(arg) : 0; }
+};
+
+class FtpVirtualFiles
+{
+public:
+  FtpVirtualFiles();
+
+  boolean add(const char *path, FtpVirtualRead read, FtpVirtualSize size, void *arg);
+  void remove(const char *path);
+  FtpVirtualFile *find(const char *path);
+
+  // Next virtual file below dir, from slot index on. name is set to its
+  // path relative to dir; only the files directly in dir if not recursive.
+  FtpVirtualFile *next(const char *dir, boolean recursive, uint8_t &index, const char **name);
+
+private:
+  FtpVirtualFile files[FTP_VIRTUAL_FILES];
+};
+
+#endif // FTP_VIRTUAL_H
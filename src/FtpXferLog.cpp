@@ -0,0 +1,86 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Transfer log
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FtpServer.h"
+
+void FtpXferLog::add(const char *line)
+{
+  size_t n = strlen(line);
+  if (n > sizeof(buf))
+    n = sizeof(buf);
+  if (len + n > sizeof(buf))
+    flush();
+  if (len + n > sizeof(buf))
+  {
+    // the lines that could not be written are kept first
+    FTPdebug("journal des transferts plein, ligne perdue\n");
+    return;
+  }
+  if (len == 0)
+    millisFirst = FTP_MILLIS();
+  memcpy(buf + len, line, n);
+  len += n;
+}
+
+boolean FtpXferLog::due()
+{
+  // after a failed write, only once FTP_XFERLOG_DELAY is over
+  return len > 0 && ((!retry && len >= sizeof(buf) * 3 / 4) || FTP_MILLIS() - millisFirst >= FTP_XFERLOG_DELAY);
+}
+
+void FtpXferLog::retryLater()
+{
+  retry = true;
+  millisFirst = FTP_MILLIS();
+}
+
+boolean FtpXferLog::flush()
+{
+  if (len == 0)
+    return false;
+  uint32_t size;
+  time_t mtime;
+  boolean isDir;
+  if (FtpDirIterator::stat(FTP_XFERLOG_PATH, &size, &mtime, &isDir) && size + len > FTP_XFERLOG_MAX)
+  {
+    FTP_FS.remove(FTP_XFERLOG_PATH ".1");
+    FTP_FS.rename(FTP_XFERLOG_PATH, FTP_XFERLOG_PATH ".1");
+    FTPdebug("rotation du journal des transferts\n");
+  }
+  File f = FTP_FS.open(FTP_XFERLOG_PATH, "a");
+  if (!f)
+  {
+    FTPdebug("journal des transferts inaccessible\n");
+    retryLater();
+    return false;
+  }
+  size_t written = f.write((uint8_t *)buf, len);
+  f.close();
+  if (written < len)
+  {
+    FTPdebug("journal des transferts incomplet, système de fichiers plein\n");
+    // what was written stays in the file, the rest is for the next try
+    memmove(buf, buf + written, len - written);
+    len -= written;
+    retryLater();
+    return true;
+  }
+  len = 0;
+  retry = false;
+  return true;
+}
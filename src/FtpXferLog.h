@@ -0,0 +1,72 @@
+/*
+ * FTP SERVER FOR ESP8266 & ESP32
+ * Transfer log
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FTP_XFERLOG_H
+#define FTP_XFERLOG_H
+
+// One line per RETR or STOR, in the xferlog format of wu-ftpd:
+//
+//   <date> <seconds> <peer> <bytes> <path> b _ <o|i> r <user> ftp 0 * <c|i>
+//
+// o for a download, i for an upload, and c when the transfer completed,
+// i when it did not. The lines are kept in RAM and appended to
+// FTP_XFERLOG_PATH a batch at a time, when the buffer is nearly full or
+// its oldest line is FTP_XFERLOG_DELAY old, and only while no server is
+// transferring (a full buffer is written at once). Past FTP_XFERLOG_MAX bytes the file becomes
+// "<path>.1", replacing the previous one. What a write could not store
+// (file system full) stays in RAM and is tried again FTP_XFERLOG_DELAY
+// later; the new lines are lost while there is no room for them.
+//
+// Include through FtpServer.h.
+
+#ifndef FTP_XFERLOG
+#define FTP_XFERLOG 0 // keep a transfer log
+#endif
+#ifndef FTP_XFERLOG_PATH
+#define FTP_XFERLOG_PATH "/xferlog"
+#endif
+#ifndef FTP_XFERLOG_BUFFER
+#define FTP_XFERLOG_BUFFER 1024 // lines kept in RAM before they are written
+#endif
+#ifndef FTP_XFERLOG_DELAY
+#define FTP_XFERLOG_DELAY 60000 // ms a line may wait in RAM
+#endif
+#ifndef FTP_XFERLOG_MAX
+#define FTP_XFERLOG_MAX 32768 // size of the log before it is rotated
+#endif
+
+class FtpXferLog
+{
+public:
+  FtpXferLog() : len(0), retry(false) {}
+
+  // Keep a line, written by a flush() to come, or now if the buffer is full
+  void add(const char *line);
+  boolean due(); // the buffer should be written
+  boolean flush(); // true if FTP_FS was written
+
+private:
+  void retryLater();
+
+  char buf[FTP_XFERLOG ? FTP_XFERLOG_BUFFER : 1];
+  uint16_t len;
+  boolean retry;        // the last flush() could not write it all
+  uint32_t millisFirst; // time of the oldest line of buf, or of the failed flush()
+};
+
+#endif // FTP_XFERLOG_H